@@ -0,0 +1,20 @@
+
+function init(processor_name)
+
+    logf(INFO, "initializing lua burst packet processor %s", processor_name)
+
+end
+
+function process_burst(packets, n, verdicts)
+
+    for i = 1, n
+    do
+        local packet = packets[i]
+
+        if packet:get_src_endpoint_id() == 0 then
+            verdicts[i] = 1
+        else
+            verdicts[i] = 0
+        end
+    end
+end
@@ -0,0 +1,21 @@
+
+function init(processor_name)
+
+    logf(INFO, "initializing lua ffi packet processor %s", processor_name)
+
+end
+
+-- packets and verdicts are ffi arrays and therefore zero based
+function process_burst(packets, n, verdicts)
+
+    for i = 0, n - 1
+    do
+        local packet = packets[i]
+
+        if packet.info.src_endpoint_id == 0 then
+            verdicts[i] = 1
+        else
+            verdicts[i] = 0
+        end
+    end
+end
@@ -0,0 +1,25 @@
+
+-- Decides once per flow. Use with defer_new_flows = "true" to keep lua off the datapath entirely
+
+function init(processor_name)
+
+    logf(INFO, "initializing lua flow hook processor %s", processor_name)
+
+end
+
+function on_new_flow(flow)
+
+    logf(INFO, "new flow %s:%u -> %s:%u", ipv4_to_str(flow.src_ip), flow.src_port, ipv4_to_str(flow.dst_ip), flow.dst_port)
+
+    if flow.proto == IP_PROTO_ICMP then
+        return BROADCAST
+    end
+
+    return 1
+end
+
+function on_flow_expire(flow, stats)
+
+    logf(INFO, "flow %s -> %s expired after %.3f s: %u packets, %u bytes", ipv4_to_str(flow.src_ip), ipv4_to_str(flow.dst_ip), stats.duration, stats.packets, stats.bytes)
+
+end
@@ -0,0 +1,39 @@
+
+-- Periodic work on the control thread. The datapath only ever reads the published snapshot
+
+local blocklist = shared_map("blocklist")
+
+local refreshes = 0
+
+local function refresh_blocklist()
+
+    refreshes = refreshes + 1
+
+    -- Would normally come from a file or a controller. Keys are host order ipv4 addresses
+    local entries = {}
+
+    entries[0x0a000001] = 1
+    entries[0x0a000002] = refreshes
+
+    blocklist:publish(entries)
+
+    logf(INFO, "blocklist refreshed, %u entries", blocklist:size())
+
+end
+
+function init(processor_name)
+
+    logf(INFO, "initializing lua timer processor %s", processor_name)
+
+    add_timer(1000, refresh_blocklist)
+
+end
+
+function process(packet)
+
+    if packet:is_ipv4() and blocklist:get(packet:get_src_ipv4()) then
+        return DROP
+    end
+
+    return packet:get_dst_endpoint_id()
+end
@@ -8,6 +8,8 @@
 
 #include "common/common.hpp"
 
+#include "dpdk/dpdk_common.hpp"
+
 #include <filesystem>
 #include <functional>
 #include <limits>
@@ -149,6 +151,11 @@ public:
         return flowtable_capacity.value;
     }
 
+    // Default for all endpoints. burst_size_min below burst_size enables adaptive RX bursts
+    burst_size_limits get_burst_limits() const noexcept {
+        return {(uint16_t) std::min(burst_size_min.value, burst_size.value), (uint16_t) burst_size.value};
+    }
+
 
 private:
     std::vector< std::reference_wrapper< config_param_base > > dataplane_config_params;
@@ -156,4 +163,6 @@ private:
     config_param< size_t, min_max_limits< size_t > > primary_pkt_allocator_capacity;
     config_param< size_t, min_max_limits< size_t > > primary_pkt_allocator_cache_size;
     config_param< size_t, min_max_limits< size_t > > flowtable_capacity;
+    config_param< size_t, min_max_limits< size_t > > burst_size;
+    config_param< size_t, min_max_limits< size_t > > burst_size_min;
 };
@@ -14,15 +14,32 @@
 std::string load_file_as_string(const std::filesystem::path& file_path);
 
 
+/**
+ * @brief A single file watched by a filesystem_watcher. The parent directory is watched instead of the file itself so
+ * that editors replacing the file (write to a temporary file and rename) are detected as well.
+ */
 class filesystem_watch
 {
 public:
+    explicit filesystem_watch(std::filesystem::path path);
+
+    const std::filesystem::path& get_path() const noexcept {
+        return path;
+    }
+
+    std::filesystem::path get_directory() const;
+
+    std::string get_filename() const;
 
 private:
     std::filesystem::path path;
 };
 
 
+/**
+ * @brief inotify backed watcher for a set of files. Never blocks unless wait is called explicitly, so it can be polled
+ * from any control loop.
+ */
 class filesystem_watcher : noncopyable, public virtual fdescriptor
 {
 public:
@@ -30,10 +47,16 @@ public:
 
     ~filesystem_watcher() override;
 
+    void add_watch(const filesystem_watch& watch);
+
     fdescriptor::fdtype get_fd() const override;
 
+    // Waits until there are pending events. fd_op_flags is ignored, there is nothing but reading for an inotify fd
     bool wait(uint32_t fd_op_flags, uint32_t timeout_ms) override;
 
+    // Drains all pending events and returns every watched file that got modified, created or moved in since the last call
+    std::vector< std::filesystem::path > poll_changes();
+
 
 private:
     struct private_data;
@@ -11,11 +11,13 @@
 
 #include <sol/sol.hpp>
 
+#include <memory>
 #include <optional>
 #include <string_view>
 #include <set>
 #include <list>
 #include <map>
+#include <variant>
 
 class lua_engine;
 
@@ -89,13 +91,25 @@ private:
 class lua_engine : noncopyable
 {
 public:
-    lua_engine();
+    /**
+     * @brief alloc_func replaces the default allocator of the lua state. Falls back to the default allocator with a
+     * warning if the lua runtime does not accept custom allocators (LuaJIT on x64 without GC64).
+     */
+    explicit lua_engine(lua_Alloc alloc_func = nullptr, void* alloc_ud = nullptr);
 
     ~lua_engine();
 
     void load_stdlibs();
 
-    void execute(const std::string& script, const std::string& script_name = std::string());
+    void execute(const std::string& script,
+                 const std::string& script_name = std::string(),
+                 sol::load_mode     mode        = sol::load_mode::text);
+
+    /**
+     * @brief Compiles a script without running it and returns the resulting bytecode. The bytecode can be passed to
+     * execute (with sol::load_mode::binary) of any other engine. Throws if the script does not compile.
+     */
+    std::string compile(const std::string& script, const std::string& script_name);
 
     template <class T>
     void load_extension(lua_engine_extension<T>& extension) {
@@ -159,6 +173,10 @@ public:
         return state;
     }
 
+    bool has_custom_allocator() const noexcept {
+        return custom_allocator;
+    }
+
 private:
     void _binding_log(int level, std::string msg);
 
@@ -166,6 +184,8 @@ private:
                                           sol::optional< const std::exception& > maybe_exception,
                                           sol::string_view                       description);
 
+    bool custom_allocator;
+
     sol::state state;
 
     std::mutex resource_lock;
@@ -174,6 +194,82 @@ private:
 };
 
 
+/**
+ * @brief Process wide cache of compiled scripts keyed by a hash of the script source. Everyone loading the same
+ * script shares one copy of the bytecode and only the first one pays for compiling it. Entries only live as long as
+ * someone holds the bytecode.
+ */
+class lua_bytecode_cache : noncopyable
+{
+public:
+    using bytecode_ptr = std::shared_ptr< const std::string >;
+
+    static lua_bytecode_cache& instance();
+
+    // Throws if the script does not compile. Failed compilations are not cached
+    bytecode_ptr get_or_compile(const std::string& script, const std::string& script_name);
+
+    uint64_t get_hits() const noexcept {
+        return hits;
+    }
+
+    uint64_t get_misses() const noexcept {
+        return misses;
+    }
+
+private:
+    lua_bytecode_cache() : hits(0), misses(0) {}
+
+    struct cache_entry
+    {
+        // Compared on lookup, the hash alone may collide. The chunk name is baked into the bytecode, so it has to match
+        // as well
+        std::string script;
+
+        std::string script_name;
+
+        std::weak_ptr< const std::string > bytecode;
+    };
+
+    std::mutex cache_lock;
+
+    std::multimap< size_t, cache_entry > entries;
+
+    uint64_t hits;
+
+    uint64_t misses;
+};
+
+
+/**
+ * @brief Immutable set of key/value pairs that can be published to any number of lua engines. Each engine gets its own
+ * read only copy so reading it from a script never leaves the lua state.
+ */
+class lua_shared_table
+{
+public:
+    using value_type = std::variant< bool, double, std::string >;
+
+    void set(const std::string& key, value_type value);
+
+    // "true"/"false" become booleans, anything that fully parses as number becomes a number, the rest stays a string
+    void set_from_string(const std::string& key, const std::string& value);
+
+    bool empty() const noexcept {
+        return entries.empty();
+    }
+
+    size_t size() const noexcept {
+        return entries.size();
+    }
+
+    void publish(lua_engine& engine, const char* name) const;
+
+private:
+    std::map< std::string, value_type > entries;
+};
+
+
 template < class T >
 lua_engine_extension<T>::~lua_engine_extension() {
     clear();
@@ -28,14 +28,32 @@ constexpr const uint16_t PORT_ID_BROADCAST = 0xffff;
 constexpr const uint16_t PORT_ID_DROP      = 0x7fff;
 constexpr const uint16_t PORT_ID_IGNORE    = 0xbfff;
 
+// PORT_ID_MULTICAST_BASE + n sends a packet to all members of multicast group n
+constexpr const uint16_t PORT_ID_MULTICAST_BASE = 0x8000;
+constexpr const uint16_t MAX_MULTICAST_GROUPS   = 256;
+
+static __inline bool is_multicast_endpoint_id(uint16_t endpoint_id) {
+    return (uint16_t) (endpoint_id - PORT_ID_MULTICAST_BASE) < MAX_MULTICAST_GROUPS;
+}
+
 using flow_hash = uint64_t;
 
+// Size of the scratch area every flow entry carries for processors. Cleared when the entry is (re)used for a new flow
+constexpr const size_t FLOW_LOCAL_STORAGE_SIZE = 64;
+
 struct flow_info_ipv4
 {
     uint64_t flow_hash;
 
     uint64_t last_used;
 
+    // tsc of the first packet
+    uint64_t first_seen;
+
+    // Updated by the classifier. Approximate if more than one lcore sees the same flow
+    uint64_t packets;
+    uint64_t bytes;
+
     uint64_t mark;
 
     uint32_t src_addr;
@@ -51,6 +69,9 @@ struct flow_info_ipv4
 
     uint8_t ipv4_proto;
 
+    // Epoch of the filter that set overwrite_dst_port. A cached verdict is only valid for the same epoch
+    uint32_t verdict_epoch;
+
     __inline bool get_mark_bit(uint8_t idx) const noexcept {
         return (mark & (1 << idx));
     }
@@ -60,6 +81,13 @@ struct flow_info_ipv4
     }
 };
 
+// The flow local storage directly follows the flow_info_ipv4 within the same flow database element
+static __inline uint8_t* get_flow_local_storage(flow_info_ipv4* flow_info) {
+    return reinterpret_cast< uint8_t* >(flow_info + 1);
+}
+
+static_assert((sizeof(flow_info_ipv4) % alignof(uint64_t)) == 0, "flow local storage must be 8 byte aligned");
+
 struct packet_private_info
 {
     // non-null if packet belongs to known flow
@@ -128,4 +156,48 @@ static __inline void init_flow_info_ipv4(flow_info_ipv4*      flow_info,
 
 bool calc_flow_hash(rte_mbuf* mbuf, flow_hash* flow_hash);
 
+/**
+ * @brief Reads an integer at offset from the start of the frame and converts it from network byte order. Works across
+ * segment boundaries like rte_pktmbuf_read. Returns false if the value is not completely within the packet.
+ */
+template < class T >
+static __inline bool packet_read_be(const rte_mbuf* mbuf, uint32_t offset, T& value) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "unsupported integer size");
+
+    T tmp;
+
+    const void* ptr = rte_pktmbuf_read(mbuf, offset, sizeof(T), &tmp);
+
+    if ( unlikely(ptr == nullptr) ) {
+        return false;
+    }
+
+    // Only points into the packet if the value is within one segment, otherwise it already is &tmp
+    if ( likely(ptr != &tmp) ) {
+        std::memcpy(&tmp, ptr, sizeof(T));
+    }
+
+    if constexpr ( sizeof(T) == 1 ) {
+        value = tmp;
+    } else if constexpr ( sizeof(T) == 2 ) {
+        value = rte_be_to_cpu_16(tmp);
+    } else {
+        value = rte_be_to_cpu_32(tmp);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Compares len bytes at offset from the start of the frame with data, across segment boundaries. Returns false
+ * if the range is not completely within the packet.
+ */
+bool packet_compare(const rte_mbuf* mbuf, uint32_t offset, const void* data, uint32_t len);
+
+/**
+ * @brief Searches needle within [offset, offset + max_len) of the frame, across segment boundaries. Returns the offset
+ * of the first match from the start of the frame or -1.
+ */
+int64_t packet_find(const rte_mbuf* mbuf, uint32_t offset, uint32_t max_len, const void* needle, uint32_t needle_len);
+
 std::string ipv4_to_str(uint32_t ipv4);
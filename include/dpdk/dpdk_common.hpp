@@ -22,6 +22,17 @@
 
 class mbuf_vec_base;
 
+// Upper bound for the number of packets handled in one burst by any stage
+constexpr const uint16_t MAX_BURST_SIZE = 128;
+
+// Number of packets an endpoint receives or transmits at once. The RX side adapts between the two, see
+// adaptive_burst_size. Both equal means a fixed burst size
+struct burst_size_limits
+{
+    uint16_t min_size;
+    uint16_t max_size;
+};
+
 class lcore_info : public std::pair< uint32_t, int >
 {
 public:
@@ -103,6 +114,12 @@ struct dpdk_memzone_deleter
     void operator()(const rte_memzone* memzone);
 };
 
+// For rings that don't carry mbufs. See rte_ring_deleter for the ones that do
+struct dpdk_ring_deleter
+{
+    void operator()(rte_ring* ring);
+};
+
 
 class dpdk_packet_mempool : noncopyable
 {
@@ -300,6 +317,11 @@ public:
         mbuf_vec_base::free();
     }
 
+    // Limits how many packets fit in without touching the storage. Only valid while empty
+    __inline void set_capacity(uint16_t new_capacity) noexcept {
+        update(mbuf_mem.data(), std::min< uint16_t >(new_capacity, MAX_SIZE));
+    }
+
     using mbuf_vec_base::capacity;
     using mbuf_vec_base::base;
     using mbuf_vec_base::free;
@@ -411,6 +433,11 @@ public:
         return (rte_ring_enqueue(ring.get(), mbuf) == 0);
     }
 
+    // Enqueues as many as fit, the rest stays with the caller. Returns the number enqueued
+    __inline uint16_t enqueue_burst(rte_mbuf* const* mbufs, uint16_t num) {
+        return (uint16_t) rte_ring_enqueue_burst(ring.get(), reinterpret_cast< void* const* >(mbufs), num, nullptr);
+    }
+
     __inline uint16_t dequeue(mbuf_vec_base& mbuf_vec) {
         uint16_t num = mbuf_vec.num_free_tail();
 
@@ -0,0 +1,109 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#pragma once
+
+#include <common/common.hpp>
+
+#include "dpdk_common.hpp"
+
+#include <array>
+#include <unordered_map>
+
+
+/**
+ * @brief Memory for exactly one lua state, taken from hugepage memory on a given NUMA node. Small blocks come from
+ * per size class free lists that are refilled from larger chunks, everything beyond the largest class is allocated
+ * directly. Never returns memory to DPDK before destruction. Not thread safe, just like the lua state using it.
+ */
+class dpdk_lua_arena : noncopyable
+{
+public:
+    // limit_bytes is a hard limit on the memory taken from DPDK, chunks included. 0 means no limit.
+    dpdk_lua_arena(int socket_id, size_t limit_bytes);
+
+    ~dpdk_lua_arena();
+
+    /**
+     * @brief lua_Alloc compatible entry point. ud must point to the arena.
+     */
+    static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+
+    int get_socket_id() const noexcept {
+        return socket_id;
+    }
+
+    // Bytes handed out to lua, rounded up to the size classes
+    size_t get_used() const noexcept {
+        return used;
+    }
+
+    // Bytes taken from DPDK. This is what the limit applies to
+    size_t get_reserved() const noexcept {
+        return reserved;
+    }
+
+    uint64_t get_failed_allocations() const noexcept {
+        return failed_allocations;
+    }
+
+private:
+    static constexpr size_t MIN_CLASS_SHIFT  = 4;
+    static constexpr size_t MAX_CLASS_SHIFT  = 12;
+    static constexpr size_t NUM_SIZE_CLASSES = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+    static constexpr size_t MAX_CLASS_SIZE   = size_t(1) << MAX_CLASS_SHIFT;
+
+    static constexpr size_t CHUNK_SIZE = 256 * 1024;
+
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    static __inline size_t get_size_class(size_t size) noexcept {
+        if ( size <= (size_t(1) << MIN_CLASS_SHIFT) ) {
+            return 0;
+        }
+
+        return (64 - __builtin_clzll(size - 1)) - MIN_CLASS_SHIFT;
+    }
+
+    static __inline size_t get_class_size(size_t size_class) noexcept {
+        return size_t(1) << (size_class + MIN_CLASS_SHIFT);
+    }
+
+    // ignore_limit is for shrinking, which lua expects to never fail. The old block is released right after anyway.
+    void* allocate(size_t size, bool ignore_limit = false);
+
+    void deallocate(void* ptr, size_t size);
+
+    void* reallocate(void* ptr, size_t old_size, size_t new_size);
+
+    bool reserve(size_t size, bool ignore_limit);
+
+    void* refill(size_t size_class, bool ignore_limit);
+
+    int socket_id;
+
+    size_t limit;
+
+    size_t used;
+
+    size_t reserved;
+
+    uint64_t failed_allocations;
+
+    std::array< free_block*, NUM_SIZE_CLASSES > free_lists;
+
+    // Unused rest of the chunk the size classes are currently refilled from
+    uint8_t* chunk_pos;
+    uint8_t* chunk_end;
+
+    std::vector< void* > chunks;
+
+    // Large blocks that lua failed to shrink, with their real size. Lua frees them with the smaller one
+    std::unordered_map< void*, size_t > kept_blocks;
+};
@@ -0,0 +1,156 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#pragma once
+
+#include "common/common.hpp"
+
+#include "dpdk/dpdk_common.hpp"
+
+#include <rte_lcore.h>
+
+#include <array>
+
+#if TELEMETRY_ENABLED == 1
+class telemetry_distributor;
+class metric_base;
+#endif
+
+
+enum class drop_reason : uint8_t
+{
+    // Rejected by the ingress validator
+    INVALID_PACKET,
+    // A processing stage returned less packets than it was given
+    PROCESSOR,
+    // Destination was PORT_ID_DROP
+    VERDICT,
+    // Destination endpoint does not exist
+    NO_ROUTE,
+    // Distributor ring of the destination endpoint was full
+    RING_FULL,
+    // Could not copy a shared broadcast or multicast packet for a TX chain
+    COPY_FAILED,
+    // Left over after tx_burst
+    TX_FAILED,
+
+    NUM_REASONS
+};
+
+constexpr const size_t NUM_DROP_REASONS = (size_t) drop_reason::NUM_REASONS;
+
+const char* get_drop_reason_name(drop_reason reason);
+
+
+constexpr const size_t DROP_SAMPLE_HEADER_SIZE = 64;
+
+struct drop_sample
+{
+    // TSC of the drop
+    uint64_t timestamp;
+
+    uint32_t pkt_len;
+
+    uint32_t lcore_id;
+
+    uint16_t src_endpoint_id;
+
+    uint16_t dst_endpoint_id;
+
+    uint16_t header_len;
+
+    drop_reason reason;
+
+    // First header_len bytes of the packet
+    uint8_t header[DROP_SAMPLE_HEADER_SIZE];
+};
+
+
+/**
+ * @brief Counts dropped packets by reason. Every lcore writes to its own cache line so counting needs no atomics,
+ * readers sum up all lcores and may see slightly stale values. Optionally copies the headers of every n-th dropped
+ * packet into a ring that is drained from the main thread.
+ */
+class drop_stats : noncopyable
+{
+public:
+    drop_stats();
+
+    ~drop_stats();
+
+    /**
+     * @brief Must be called right before the packets get freed, the mbufs are only read for sampling.
+     */
+    __inline void record(drop_reason reason, rte_mbuf* const* mbufs, uint16_t num) noexcept {
+        lcore_data& data = get_lcore_data();
+
+        data.counters[(size_t) reason] += num;
+
+        if ( unlikely(sample_interval != 0) ) {
+            sample(data, reason, mbufs, num);
+        }
+    }
+
+    __inline void record(drop_reason reason, rte_mbuf* mbuf) noexcept {
+        record(reason, &mbuf, 1);
+    }
+
+    // For drops without a packet to sample
+    __inline void count(drop_reason reason, uint16_t num = 1) noexcept {
+        get_lcore_data().counters[(size_t) reason] += num;
+    }
+
+    uint64_t get_total(drop_reason reason) const noexcept;
+
+    /**
+     * @brief Samples every sample_interval-th drop of each lcore. Needs an initialized EAL and must be called before
+     * the flows are started. ring_size must be a power of two.
+     */
+    void enable_sampling(uint32_t sample_interval, uint32_t ring_size);
+
+    // Releases the sample ring, has to happen before the EAL is cleaned up. The flows must be stopped
+    void disable_sampling();
+
+    bool is_sampling() const noexcept {
+        return sample_interval != 0;
+    }
+
+    // Returns the number of samples written to samples
+    size_t read_samples(drop_sample* samples, size_t max_samples);
+
+#if TELEMETRY_ENABLED == 1
+    void init_telemetry(telemetry_distributor& telemetry);
+#endif
+
+private:
+    struct alignas(RTE_CACHE_LINE_SIZE) lcore_data
+    {
+        std::array< uint64_t, NUM_DROP_REASONS > counters;
+
+        uint32_t drops_since_sample;
+    };
+
+    __inline lcore_data& get_lcore_data() noexcept {
+        unsigned lcore_id = rte_lcore_id();
+
+        // Non EAL threads share the last slot
+        return per_lcore_data[(lcore_id < RTE_MAX_LCORE) ? lcore_id : RTE_MAX_LCORE];
+    }
+
+    void sample(lcore_data& data, drop_reason reason, rte_mbuf* const* mbufs, uint16_t num) noexcept;
+
+    std::array< lcore_data, RTE_MAX_LCORE + 1 > per_lcore_data;
+
+    uint32_t sample_interval;
+
+    std::unique_ptr< rte_ring, dpdk_ring_deleter > sample_ring;
+
+#if TELEMETRY_ENABLED == 1
+    std::unique_ptr< metric_base > metric;
+#endif
+};
+
+extern drop_stats packet_drop_stats;
@@ -113,9 +113,28 @@ private:
 
 
 
+struct flow_lcore_cache;
+
+/**
+ * @brief Snapshot of a flow entry taken right before the entry gets recycled.
+ */
+struct flow_expire_event
+{
+    flow_info_ipv4 info;
+
+    uint8_t storage[FLOW_LOCAL_STORAGE_SIZE];
+};
+
 class flow_database : public flow_component
 {
 public:
+    // Number of entries of the per-lcore direct mapped flow cache. Must be a power of two.
+    static constexpr size_t LCORE_CACHE_SIZE = 64;
+
+    // Evicted entries an lcore can hold back until no other lcore can use them anymore. While full, new flows that
+    // would need an eviction don't get an entry
+    static constexpr uint32_t MAX_RETIRED_ENTRIES = 4 * MAX_BURST_SIZE;
+
     flow_database(size_t max_entries, std::vector<lcore_info> write_allowed_lcores);
 
     ~flow_database();
@@ -130,6 +149,28 @@ public:
 
     void set_lcore_inactive(unsigned int lcore_id);
 
+    /**
+     * @brief Blocks until every active lcore passed flow_purge_checkpoint at least once. Everything that got unlinked
+     * from the datapath before this call can be freed afterwards. Must not be called from an active lcore.
+     */
+    void rcu_synchronize();
+
+    /**
+     * @brief Creates a ring that receives a flow_expire_event for every flow entry that gets evicted from now on.
+     * The ring is owned by the database and has exactly one consumer. Events are lost while it's full.
+     * Must be called from the main thread, the datapath may be running.
+     */
+    rte_ring* subscribe_expired_flows(size_t capacity);
+
+    /**
+     * @brief Stops the events of a ring returned by subscribe_expired_flows and destroys the ring. Blocks until no lcore
+     * can be enqueueing to it anymore. Must be called from the main thread.
+     */
+    void unsubscribe_expired_flows(rte_ring* ring);
+
+    // Events that didn't fit into the ring of a subscription because it was full
+    uint64_t get_num_lost_expire_events(const rte_ring* ring) const;
+
     size_t get_num_flows();
 
 private:
@@ -145,12 +186,45 @@ private:
 
     std::unique_ptr<rte_mempool, mempool_deleter> mempool;
 
+    // Returns retired entries whose grace period is over to the pool. Never blocks
+    uint32_t reclaim_entries(flow_lcore_cache& cache);
+
+    // Sends the expire events of an entry nobody can use anymore and puts it back into the pool
+    void expire_entry(flow_info_ipv4* entry);
+
+    // Flow entries retired by get_or_create. Like sync_rcu_state only reported on in flow_purge_checkpoint
     std::unique_ptr<rte_rcu_qsbr, dpdk_malloc_deleter> rcu_state;
 
+    // Backs rcu_synchronize. Kept apart so that the expire subscriptions stay valid while flow_purge_checkpoint
+    // reclaims entries
+    std::unique_ptr<rte_rcu_qsbr, dpdk_malloc_deleter> sync_rcu_state;
+
     size_t flow_table_memsize;
 
     std::unique_ptr<const rte_memzone, dpdk_memzone_deleter> table_memory;
 
+    std::array<std::unique_ptr<flow_lcore_cache, dpdk_malloc_deleter>, RTE_MAX_LCORE> lcore_caches;
+
+    struct expire_subscription
+    {
+        std::unique_ptr< rte_ring, dpdk_ring_deleter > ring;
+
+        std::atomic_uint64_t num_lost {0};
+    };
+
+    // Replaces the list the datapath reads by one built from expire_subscriptions
+    void publish_expire_subscriptions();
+
+    // Owns the subscriptions. Only used by the main thread
+    std::vector< std::unique_ptr< expire_subscription > > expire_subscriptions;
+
+    // Read by get_or_create. Never changed in place but replaced as a whole, nullptr while there are no subscriptions
+    std::unique_ptr< const std::vector< expire_subscription* > > expire_subscription_list;
+
+    std::atomic< const std::vector< expire_subscription* >* > active_expire_subscriptions {nullptr};
+
+    // Ring names must be unique while the rings exist
+    size_t next_expire_ring_id = 0;
 };
 
 template < class TFlowManager >
@@ -173,6 +247,11 @@ public:
 
     virtual void stop() = 0;
 
+    // Lcore of each endpoint, indexed like the endpoints. Valid after setup
+    virtual const std::vector< lcore_info >& get_endpoint_lcores() const noexcept = 0;
+
+    virtual const std::vector< lcore_info >& get_distributor_lcores() const noexcept = 0;
+
 protected:
     flow_manager_type& get_flow_manager() noexcept {
         return flow_manager;
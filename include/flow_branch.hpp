@@ -0,0 +1,66 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#pragma once
+
+#include "common/common.hpp"
+
+#include "flow_processor.hpp"
+#include "flow_manager.hpp"
+
+
+enum class flow_branch_type
+{
+    // Outputs tcp, udp, icmp, other
+    PROTO,
+
+    // Outputs new, known. new is the first packet of a flow, packets without a flow are known
+    NEW_FLOW
+};
+
+/**
+ * @brief Splits the burst across named outputs, each of which may have its own processing chain attached
+ * (proc:output(name, first_proc) in the init script). Every sub-burst runs through its chain, whatever survives is
+ * merged back and continues with the next processor after the branch. Packets of outputs without a chain just pass.
+ * Packet order is kept within an output, not across outputs.
+ */
+class flow_branch : public flow_processor
+{
+public:
+    static constexpr size_t MAX_OUTPUTS = 4;
+
+    flow_branch(std::string                            name,
+                std::shared_ptr< dpdk_packet_mempool > mempool,
+                std::shared_ptr< flow_database >       flow_database_ptr);
+
+    ~flow_branch() override = default;
+
+    uint16_t process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) override;
+
+    void init(const flow_proc_builder& builder) override;
+
+    void lcore_init(uint32_t lcore_id) override;
+
+    void control_poll() override;
+
+    bool writes_packets() const noexcept override;
+
+#if TELEMETRY_ENABLED == 1
+    void init_telemetry(telemetry_distributor& telemetry) override;
+#endif
+
+private:
+    uint8_t select_output(rte_mbuf* mbuf) const noexcept;
+
+    std::shared_ptr< flow_database > flow_database_ptr;
+
+    flow_branch_type branch_type;
+
+    std::vector< std::string > output_names;
+
+    // Indexed like output_names. Empty for outputs nothing is attached to
+    std::array< std::unique_ptr< packet_proc_flow >, MAX_OUTPUTS > output_flows;
+};
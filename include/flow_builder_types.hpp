@@ -77,16 +77,29 @@ public:
 
     std::optional< std::string > get_param(const std::string& key) const;
 
+    const std::map< std::string, std::string >& get_params() const noexcept {
+        return params;
+    }
+
     std::shared_ptr< flow_proc_builder > next(std::shared_ptr< flow_proc_builder > p);
 
     std::shared_ptr< flow_proc_builder > get_next_proc() const {
         return next_proc;
     }
 
+    // Start of the chain attached to the named output of a branching processor (see flow_branch)
+    std::shared_ptr< flow_proc_builder > output(const std::string& output_name, std::shared_ptr< flow_proc_builder > p);
+
+    const std::map< std::string, std::shared_ptr< flow_proc_builder > >& get_outputs() const noexcept {
+        return outputs;
+    }
+
 private:
     std::map< std::string, std::string > params;
 
     std::shared_ptr< flow_proc_builder > next_proc;
+
+    std::map< std::string, std::shared_ptr< flow_proc_builder > > outputs;
 };
 
 class flow_endpoint_builder : public flow_builder_node
@@ -111,9 +124,18 @@ public:
         return port_num;
     }
 
+    // Overrides the burst size limits from the app config for this endpoint. Throws on invalid limits
+    void set_burst_size(uint16_t max_size, uint16_t min_size);
+
+    std::optional< burst_size_limits > get_burst_limits() const {
+        return burst_limits;
+    }
+
 private:
     std::shared_ptr< flow_proc_builder > first_rx_proc;
     std::shared_ptr< flow_proc_builder > first_tx_proc;
 
+    std::optional< burst_size_limits > burst_limits;
+
     int port_num;
 };
\ No newline at end of file
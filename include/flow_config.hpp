@@ -70,6 +70,15 @@ public:
         return std::move(endpoint);
     }
 
+    void set_burst_limits(std::optional< burst_size_limits > limits) {
+        burst_limits = limits;
+    }
+
+    // Not set means the defaults of the flow manager
+    std::optional< burst_size_limits > get_burst_limits() const {
+        return burst_limits;
+    }
+
     std::list< std::unique_ptr< flow_processor > >::iterator rx_proc_begin() {
         return rx_procs.begin();
     }
@@ -93,6 +102,8 @@ private:
 
     std::list< std::unique_ptr< flow_processor > > rx_procs;
     std::list< std::unique_ptr< flow_processor > > tx_procs;
+
+    std::optional< burst_size_limits > burst_limits;
 };
 
 template < flow_dir DIR >
@@ -165,12 +176,23 @@ public:
         return flow_database_ptr;
     }
 
+    // Members are endpoint ids. Replaces earlier members of the same group
+    void set_multicast_group(uint16_t group_id, std::vector< uint16_t > members) {
+        multicast_groups[group_id] = std::move(members);
+    }
+
+    const std::map< uint16_t, std::vector< uint16_t > >& get_multicast_groups() const noexcept {
+        return multicast_groups;
+    }
+
 private:
     std::string program_name;
 
     std::list< flow_config > flow_configs;
 
     std::shared_ptr< flow_database > flow_database_ptr;
+
+    std::map< uint16_t, std::vector< uint16_t > > multicast_groups;
 };
 
 class init_script_handler : noncopyable
@@ -183,6 +205,10 @@ public:
     flow_program build_program(std::vector< std::unique_ptr< flow_endpoint_base > > available_endpoints,
                                const std::shared_ptr< flow_database >&              flow_database);
 
+    // For reloading the chains of endpoints that are already in use. The flows of the program have no endpoints
+    flow_program build_program(const std::vector< flow_endpoint_base* >& available_endpoints,
+                               const std::shared_ptr< flow_database >&   flow_database);
+
 private:
     void handle_flow(flow_config&                         flow,
                      flow_endpoint_base&                  endpoint,
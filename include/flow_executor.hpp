@@ -137,6 +137,14 @@ public:
         }
     }
 
+    const std::vector< lcore_info >& get_endpoint_lcores() const noexcept override {
+        return endpoint_lcores;
+    }
+
+    const std::vector< lcore_info >& get_distributor_lcores() const noexcept override {
+        return distributor_lcores;
+    }
+
 private:
     static constexpr size_t get_min_num_lcores(size_t num_flows, size_t num_distributors, size_t num_queues) {
         // TODO: Disabled since running multiple endpoints on the same lcore does not work yet
@@ -18,6 +18,61 @@
 #include "flow_telemetry.hpp"
 #endif
 
+#if STAGE_PROFILING_ENABLED == 1
+#include <rte_cycles.h>
+#endif
+
+
+#if STAGE_PROFILING_ENABLED == 1
+/**
+ * @brief Cost of one stage of a packet_proc_flow. Exported as group <chain name>::<stage name>.
+ */
+struct stage_profile : noncopyable
+{
+    explicit stage_profile(std::string name) :
+        metric_grp(std::move(name)),
+        m_calls("calls"),
+        m_cycles("cycles"),
+        m_packets_in("packets_in", metric_unit::PACKETS),
+        m_packets_out("packets_out", metric_unit::PACKETS),
+        m_cycles_per_packet("cycles_per_packet", m_cycles, m_packets_in),
+        m_burst_cycles_per_packet("burst_cycles_per_packet") {
+
+        metric_grp.add_metric(m_calls);
+        metric_grp.add_metric(m_cycles);
+        metric_grp.add_metric(m_packets_in);
+        metric_grp.add_metric(m_packets_out);
+        metric_grp.add_metric(m_cycles_per_packet);
+        metric_grp.add_metric(m_burst_cycles_per_packet);
+    }
+
+    __inline void record(uint64_t cycles, uint16_t packets_in, uint16_t packets_out) {
+        m_calls.inc();
+        m_cycles.add(cycles);
+        m_packets_in.add(packets_in);
+        m_packets_out.add(packets_out);
+
+        m_burst_cycles_per_packet.record(cycles / packets_in);
+    }
+
+    metric_group metric_grp;
+
+    per_lcore_metric< uint64_t > m_calls;
+
+    per_lcore_metric< uint64_t > m_cycles;
+
+    per_lcore_metric< uint64_t > m_packets_in;
+
+    per_lcore_metric< uint64_t > m_packets_out;
+
+    // Average over everything recorded so far
+    ratio_metric< per_lcore_metric< uint64_t >, per_lcore_metric< uint64_t > > m_cycles_per_packet;
+
+    // One sample per call. Shows how the cost per packet is spread under load, which the average hides
+    per_lcore_histogram_metric<> m_burst_cycles_per_packet;
+};
+#endif
+
 
 class packet_proc_flow : noncopyable
 {
@@ -27,7 +82,8 @@ public:
 
     static constexpr uint32_t MAX_FLOW_LENGTH = 16;
 
-    packet_proc_flow() : current_flow_length(0) {
+    // chain_name prefixes the stage names in telemetry
+    explicit packet_proc_flow(std::string chain_name = {}) : chain_name(std::move(chain_name)), current_flow_length(0) {
         for(auto& e : proc_order) {
             e = FLOW_TERMINATOR;
         }
@@ -38,6 +94,8 @@ public:
 
         size_t old_size = procs.size();
 
+        has_writing_stage = has_writing_stage || proc->writes_packets();
+
         procs.push_back(std::move(proc));
 
         proc_order[current_flow_length] = old_size;
@@ -45,7 +103,27 @@ public:
         ++current_flow_length;
     }
 
+    /**
+     * @brief Merges runs of built-in processors into statically dispatched stages. Only valid before the flow runs and
+     * before any stage got disabled, stage indices change. Does nothing with stage profiling, which needs the stages
+     * apart.
+     */
+    void fuse() {
+#if STAGE_PROFILING_ENABLED != 1
+        fuse_flow_processors(procs);
+
+        for ( size_t idx = 0; idx < MAX_FLOW_LENGTH; ++idx ) {
+            proc_order[idx] = (idx < procs.size()) ? (uint32_t) idx : FLOW_TERMINATOR;
+        }
+
+        current_flow_length = procs.size();
+#endif
+    }
+
     __inline uint16_t process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) {
+        // Groups from the previous burst must not leak into this one
+        ctx.get_flow_groups().invalidate();
+
         for ( size_t idx = 0; idx < MAX_FLOW_LENGTH; ++idx ) {
 
             uint32_t proc_id = proc_order[idx];
@@ -61,16 +139,69 @@ public:
             if ( unlikely( proc_id & INACTIVE_IDX_MASK ))
                 continue;
 
+#if STAGE_PROFILING_ENABLED == 1
+            uint16_t packets_in   = mbuf_vec.size();
+            uint64_t start_cycles = rte_rdtsc();
+#endif
+
             uint16_t ret = procs[proc_id]->process(mbuf_vec, ctx);
 
             if ( ret < mbuf_vec.size() ) {
+                packet_drop_stats.record(drop_reason::PROCESSOR, mbuf_vec.begin() + ret, mbuf_vec.size() - ret);
+
                 mbuf_vec.free_back(mbuf_vec.size() - ret);
             }
+
+#if STAGE_PROFILING_ENABLED == 1
+            // Only set once init_telemetry was called
+            if ( stage_profiles[proc_id] ) {
+                stage_profiles[proc_id]->record(rte_rdtsc() - start_cycles, packets_in, mbuf_vec.size());
+            }
+#endif
         }
 
         return mbuf_vec.size();
     }
 
+    // Called from the main thread for each lcore that is going to run the chain, before the chain gets published
+    void lcore_init(uint32_t lcore_id) {
+        for ( auto& proc : procs ) {
+            proc->lcore_init(lcore_id);
+        }
+    }
+
+    bool empty() const noexcept {
+        return procs.empty();
+    }
+
+    // True if any stage may modify packets, disabled ones included
+    __inline bool writes_packets() const noexcept {
+        return has_writing_stage;
+    }
+
+    void control_poll() {
+        for ( auto& proc : procs ) {
+            proc->control_poll();
+        }
+    }
+
+#if TELEMETRY_ENABLED == 1
+    void init_telemetry(telemetry_distributor& telemetry) {
+        for ( auto& proc : procs ) {
+            proc->init_telemetry(telemetry);
+        }
+
+#if STAGE_PROFILING_ENABLED == 1
+        for ( size_t proc_id = 0; proc_id < procs.size(); ++proc_id ) {
+            stage_profiles[proc_id] =
+                std::make_unique< stage_profile >(fmt::format("{}::{}", chain_name, procs[proc_id]->get_name()));
+
+            telemetry.add_metric(stage_profiles[proc_id]->metric_grp);
+        }
+#endif
+    }
+#endif
+
     void disable_stage(size_t idx) {
         proc_order[idx] |= INACTIVE_IDX_MASK;
 
@@ -104,17 +235,71 @@ public:
     }
 
 private:
+    std::string chain_name;
+
     std::vector< std::unique_ptr< flow_processor > > procs;
 
     std::array< uint32_t, MAX_FLOW_LENGTH > proc_order;
 
     size_t current_flow_length;
+
+    bool has_writing_stage = false;
+
+#if STAGE_PROFILING_ENABLED == 1
+    // Indexed like procs
+    std::array< std::unique_ptr< stage_profile >, MAX_FLOW_LENGTH > stage_profiles;
+#endif
+};
+
+/**
+ * @brief RX burst size of one endpoint. Doubles as soon as a burst comes back full and halves after a run of bursts that
+ * were less than half full, always within the limits. Under light load packets are handed on in small bursts instead of
+ * waiting for the rest of a large one, under heavy load the per-burst costs are spread over more packets.
+ */
+class adaptive_burst_size
+{
+public:
+    // Number of consecutive underfilled bursts before shrinking. Growing is immediate, a backlog costs more than a few
+    // small bursts
+    static constexpr uint16_t SHRINK_THRESHOLD = 8;
+
+    explicit adaptive_burst_size(burst_size_limits limits) :
+        limits(limits), current_size(limits.min_size), num_underfilled(0) {}
+
+    __inline uint16_t get() const noexcept {
+        return current_size;
+    }
+
+    __inline void update(uint16_t num_received) noexcept {
+        if ( num_received >= current_size ) {
+            current_size    = std::min< uint16_t >(current_size * 2, limits.max_size);
+            num_underfilled = 0;
+        } else if ( num_received < (current_size / 2) ) {
+            if ( ++num_underfilled >= SHRINK_THRESHOLD ) {
+                current_size    = std::max< uint16_t >(current_size / 2, limits.min_size);
+                num_underfilled = 0;
+            }
+        } else {
+            num_underfilled = 0;
+        }
+    }
+
+private:
+    burst_size_limits limits;
+
+    uint16_t current_size;
+
+    uint16_t num_underfilled;
 };
 
+// Member endpoint ids of each multicast group, indexed by group id
+using multicast_group_table = std::vector< std::vector< uint16_t > >;
+
 class flow_distributor
 {
 public:
-    flow_distributor(size_t max_ports, size_t num_queues, uint32_t ring_size);
+    // Creates num_queues rings for each of the num_ports destination ports
+    flow_distributor(size_t num_ports, size_t num_queues, uint32_t ring_size);
 
     ~flow_distributor();
 
@@ -122,16 +307,35 @@ public:
 
     uint16_t pull_packets(uint16_t port_id, uint16_t queue_id, mbuf_vec_base& mbuf_vec);
 
-    void set_num_active_ports(size_t num_ports) {
-        num_active_ports = num_ports;
-    }
+    /**
+     * @brief Replaces the member lists of the multicast groups, indexed by group id. Returns the previous table, which
+     * pushing lcores may still read until they passed flow_database::flow_purge_checkpoint.
+     */
+    std::unique_ptr< const multicast_group_table > set_multicast_groups(
+        std::unique_ptr< const multicast_group_table > groups);
 
 private:
-    size_t   max_ports;
+    // Enqueues the same packet to every port in dst_ports but src_port_id. Each destination holds one reference
+    void fan_out(rte_mbuf*       mbuf,
+                 uint16_t        src_port_id,
+                 uint16_t        queue_id,
+                 const uint16_t* dst_ports,
+                 size_t          num_dst_ports);
+
+    // Enqueues unicast packets with one burst per destination. Keeps the order per destination, consumes mbufs and dsts
+    void enqueue_unicast(uint16_t queue_id, rte_mbuf** mbufs, uint16_t* dsts, uint16_t num);
+
+    size_t   num_ports;
     size_t   num_queues;
-    size_t   num_active_ports;
     uint32_t ring_size;
 
+    // 0 .. num_ports - 1, the members of the broadcast group
+    std::vector< uint16_t > all_ports;
+
+    std::atomic< const multicast_group_table* > active_groups {nullptr};
+
+    std::unique_ptr< const multicast_group_table > groups;
+
 
     std::vector< mbuf_ring > rings;
 };
@@ -140,16 +344,34 @@ private:
 class flow_manager : noncopyable
 {
 public:
-    static constexpr const size_t MAX_NUM_FLOWS = 8;
-
+    // Default burst size if neither the config nor the flow set one
     static constexpr const size_t BURST_SIZE = 32;
 
+    static_assert(BURST_SIZE <= MAX_BURST_SIZE, "BURST_SIZE exceeds MAX_BURST_SIZE");
+
     flow_manager();
 
     ~flow_manager();
 
+    // Used by all endpoints whose flow doesn't set its own limits. Takes effect on the next load
+    void set_default_burst_limits(burst_size_limits limits) {
+        default_burst_limits = limits;
+    }
+
     void load(flow_program prog);
 
+    /**
+     * @brief Replaces the RX and TX chains of all endpoints with the ones of prog while the flows keep running. prog has
+     * to be built for the endpoints of the loaded program, its own endpoints are ignored. The multicast groups are
+     * replaced as well. The old chains are destroyed once no lcore can be using them anymore. Must be called from the
+     * main thread.
+     */
+    void reload(flow_program prog);
+
+    std::vector< flow_endpoint_base* > get_endpoints() const;
+
+    std::shared_ptr< flow_database > get_flow_database() const;
+
 #if TELEMETRY_ENABLED == 1
     void init_telemetry(telemetry_distributor& telemetry);
 #endif
@@ -158,6 +380,9 @@ public:
 
     void stop();
 
+    // Gives all processors the chance to do their control work. Must be called from the main thread
+    void poll_control();
+
 private:
     void endpoint_work_callback(const size_t* endpoint_ids, size_t num_endpoint_ids, std::atomic_bool& run_state);
 
@@ -166,4 +391,6 @@ private:
     struct private_data;
 
     std::unique_ptr< private_data > pdata;
+
+    burst_size_limits default_burst_limits;
 };
\ No newline at end of file
@@ -7,13 +7,79 @@
 #pragma once
 
 #include "common/common.hpp"
-#include "common/lua_common.hpp"
 
 #include "dpdk/dpdk_common.hpp"
 #include "dpdk/dpdk_ethdev.hpp"
 
 #include "flow_base.hpp"
 #include "flow_builder_types.hpp"
+#include "drop_stats.hpp"
+
+#include <tuple>
+#include <utility>
+
+/**
+ * @brief Per-burst grouping of packets by the flow they belong to.
+ * Packet indices are relative to the begin of the mbuf_vec the table was built for. As soon as a stage removes packets
+ * from the burst the table is no longer valid for it, which is what is_valid_for() checks.
+ */
+class flow_group_table
+{
+public:
+    static constexpr uint16_t NO_GROUP = std::numeric_limits< uint16_t >::max();
+
+    struct group
+    {
+        flow_info_ipv4* flow_info;
+
+        // Offset of the first packet index of this group
+        uint16_t first;
+
+        uint16_t count;
+    };
+
+    flow_group_table() : burst_base(nullptr), num_packets(0), num_groups(0) {}
+
+    void build(mbuf_vec_base& mbuf_vec) noexcept;
+
+    __inline void invalidate() noexcept {
+        burst_base = nullptr;
+        num_groups = 0;
+    }
+
+    __inline bool is_valid_for(mbuf_vec_base& mbuf_vec) const noexcept {
+        return (burst_base != nullptr) && (burst_base == mbuf_vec.begin()) && (num_packets == mbuf_vec.size());
+    }
+
+    __inline uint16_t size() const noexcept {
+        return num_groups;
+    }
+
+    __inline const group& operator[](uint16_t group_idx) const noexcept {
+        return groups[group_idx];
+    }
+
+    __inline const uint16_t* packet_indices(const group& g) const noexcept {
+        return indices.data() + g.first;
+    }
+
+    __inline uint16_t group_of(uint16_t packet_idx) const noexcept {
+        return group_ids[packet_idx];
+    }
+
+private:
+    rte_mbuf** burst_base;
+
+    uint16_t num_packets;
+
+    uint16_t num_groups;
+
+    std::array< group, MAX_BURST_SIZE > groups;
+
+    std::array< uint16_t, MAX_BURST_SIZE > group_ids;
+
+    std::array< uint16_t, MAX_BURST_SIZE > indices;
+};
 
 class flow_proc_context
 {
@@ -35,10 +101,20 @@ public:
         related_endpoint_id = endpoint_id;
     }
 
+    __inline flow_group_table& get_flow_groups() noexcept {
+        return flow_groups;
+    }
+
+    __inline const flow_group_table& get_flow_groups() const noexcept {
+        return flow_groups;
+    }
+
 private:
     flow_dir direction;
 
     uint16_t related_endpoint_id;
+
+    flow_group_table flow_groups;
 };
 
 class flow_processor : public flow_node_base
@@ -56,6 +132,31 @@ public:
 
     virtual void init(const flow_proc_builder& builder) = 0;
 
+    /**
+     * @brief Called from the main thread for each lcore that is going to run this processor, before the processor gets
+     * visible to that lcore. Processors that keep per lcore state set it up here, the datapath never has to.
+     */
+    virtual void lcore_init(uint32_t lcore_id) {}
+
+    /**
+     * @brief Called periodically from the main thread while the flows are running. Never called from a processing
+     * lcore, so this is the place for anything slow (reloading, rebuilding state, ...).
+     */
+    virtual void control_poll() {}
+
+    /**
+     * @brief False if the processor neither modifies packet data nor the private area of a packet, verdicts included.
+     * Broadcast and multicast packets are shared by all their destinations and only get copied for TX chains that
+     * contain a writing processor.
+     */
+    virtual bool writes_packets() const noexcept {
+        return true;
+    }
+
+#if TELEMETRY_ENABLED == 1
+    virtual void init_telemetry(telemetry_distributor& telemetry) {}
+#endif
+
 protected:
     void export_param(std::string name, parameter_constraint_type constraint_type) {
         exported_params.push_back(parameter_info(std::move(name), constraint_type));
@@ -66,7 +167,7 @@ private:
 };
 
 
-class ingress_packet_validator : public flow_processor
+class ingress_packet_validator final : public flow_processor
 {
 public:
     ingress_packet_validator(std::string name, std::shared_ptr< dpdk_packet_mempool > mempool, std::shared_ptr< flow_database > flow_database_ptr);
@@ -82,7 +183,7 @@ private:
 
 };
 
-class flow_classifier : public flow_processor
+class flow_classifier final : public flow_processor
 {
 public:
     flow_classifier(std::string                      name,
@@ -99,29 +200,146 @@ private:
     std::shared_ptr< flow_database > flow_database_ptr;
 };
 
-class lua_packet_filter : public flow_processor
+/**
+ * @brief Builds the flow group table of the current burst so that later stages can work per flow instead of per
+ * packet. Must be placed after the flow_classifier.
+ */
+class flow_grouper final : public flow_processor
 {
 public:
-    lua_packet_filter(std::string                      name,
-                    std::shared_ptr< dpdk_packet_mempool >  mempool,
-                    std::shared_ptr< flow_database > flow_database_ptr);
+    flow_grouper(std::string                            name,
+                 std::shared_ptr< dpdk_packet_mempool > mempool,
+                 std::shared_ptr< flow_database >       flow_database_ptr);
 
-    ~lua_packet_filter() override = default;
+    ~flow_grouper() override = default;
 
     uint16_t process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) override;
 
     void init(const flow_proc_builder& builder) override;
 
+    // The group table lives in the context
+    bool writes_packets() const noexcept override {
+        return false;
+    }
+};
+
+/**
+ * @brief Runs a fixed sequence of processors as a single stage. The stage types are known at compile time, so there is
+ * no virtual call between them and the compiler is free to inline one stage into the next. Only instantiated for
+ * built-in processors, see fuse_flow_processors.
+ */
+template < class... TStages >
+class fused_flow_processor final : public flow_processor
+{
+public:
+    static constexpr size_t NUM_STAGES = sizeof...(TStages);
+
+    explicit fused_flow_processor(std::unique_ptr< TStages >... stage_ptrs) :
+        flow_processor(join_stage_names(*stage_ptrs...),
+                       std::get< 0 >(std::tie(stage_ptrs...))->get_mempool_shared()),
+        stages(std::move(stage_ptrs)...) {}
+
+    ~fused_flow_processor() override = default;
+
+    uint16_t process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) override {
+        process_stages(mbuf_vec, ctx, std::index_sequence_for< TStages... > {});
+
+        return mbuf_vec.size();
+    }
+
+    // The stages were initialized before they got fused
+    void init(const flow_proc_builder& builder) override {}
+
+    void lcore_init(uint32_t lcore_id) override {
+        std::apply([lcore_id](auto&... stage) { (stage->lcore_init(lcore_id), ...); }, stages);
+    }
+
+    void control_poll() override {
+        std::apply([](auto&... stage) { (stage->control_poll(), ...); }, stages);
+    }
+
+    bool writes_packets() const noexcept override {
+        return std::apply([](const auto&... stage) { return (stage->writes_packets() || ...); }, stages);
+    }
+
+#if TELEMETRY_ENABLED == 1
+    void init_telemetry(telemetry_distributor& telemetry) override {
+        std::apply([&telemetry](auto&... stage) { (stage->init_telemetry(telemetry), ...); }, stages);
+    }
+#endif
+
+    /**
+     * @brief Replaces procs[idx] and the following stages by one fused_flow_processor if their types match TStages
+     * exactly. Returns false and leaves procs untouched otherwise.
+     */
+    static bool try_fuse(std::vector< std::unique_ptr< flow_processor > >& procs, size_t idx) {
+        return try_fuse(procs, idx, std::index_sequence_for< TStages... > {});
+    }
+
 private:
-    std::shared_ptr< flow_database > flow_database_ptr;
+    template < size_t... I >
+    __inline void process_stages(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx, std::index_sequence< I... >) {
+        (run_stage< I >(mbuf_vec, ctx) && ...);
+    }
+
+    // Same semantics as one step of packet_proc_flow::process. Returns false once the burst is empty
+    template < size_t I >
+    __inline bool run_stage(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) {
+        using stage_type = std::tuple_element_t< I, std::tuple< TStages... > >;
+
+        // Qualified call on a final class, never goes through the vtable
+        uint16_t ret = std::get< I >(stages)->stage_type::process(mbuf_vec, ctx);
+
+        if ( ret < mbuf_vec.size() ) {
+            packet_drop_stats.record(drop_reason::PROCESSOR, mbuf_vec.begin() + ret, mbuf_vec.size() - ret);
+
+            mbuf_vec.free_back(mbuf_vec.size() - ret);
+        }
+
+        return mbuf_vec.size() != 0;
+    }
+
+    template < size_t... I >
+    static bool try_fuse(std::vector< std::unique_ptr< flow_processor > >& procs,
+                         size_t                                            idx,
+                         std::index_sequence< I... >) {
+        if ( (idx + NUM_STAGES) > procs.size() ) {
+            return false;
+        }
 
-    bool eval_flow_once;
+        if ( !((dynamic_cast< TStages* >(procs[idx + I].get()) != nullptr) && ...) ) {
+            return false;
+        }
 
-    lua_engine lua;
+        auto fused = std::make_unique< fused_flow_processor >(
+            std::unique_ptr< TStages >(static_cast< TStages* >(procs[idx + I].release()))...);
 
-    sol::function process_function;
+        procs.erase(procs.begin() + idx + 1, procs.begin() + idx + NUM_STAGES);
+
+        procs[idx] = std::move(fused);
+
+        return true;
+    }
+
+    template < class... TNodes >
+    static std::string join_stage_names(const TNodes&... nodes) {
+        std::string name;
+
+        ((name += (name.empty() ? "" : "+") + nodes.get_name()), ...);
+
+        return name;
+    }
+
+    std::tuple< std::unique_ptr< TStages >... > stages;
 };
 
+/**
+ * @brief Fuses every run of built-in processors in procs that matches one of the known sequences (validator,
+ * classifier, grouper and their prefixes/suffixes) into a fused_flow_processor. Everything else stays dynamically
+ * dispatched.
+ */
+void fuse_flow_processors(std::vector< std::unique_ptr< flow_processor > >& procs);
+
 std::unique_ptr< flow_processor > create_flow_processor(std::shared_ptr<flow_proc_builder> proc_builder,
                                                         const std::shared_ptr< dpdk_packet_mempool >& mempool,
                                                         const std::shared_ptr< flow_database >& flow_database);
\ No newline at end of file
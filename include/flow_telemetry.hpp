@@ -91,6 +91,21 @@ struct add_aggregator
     }
 };
 
+template <class T>
+struct max_aggregator
+{
+    template < class TStorageAdapter, size_t N >
+    static T convert(std::array<TStorageAdapter, N>& per_lcore_data, TStorageAdapter& non_lcore_data) {
+        T result = non_lcore_data.get();
+
+        for(auto& per_lcore_val : per_lcore_data) {
+            result = std::max(result, per_lcore_val.get());
+        }
+
+        return result;
+    }
+};
+
 template < class T >
 struct atomic_storage_adapter
 {
@@ -188,6 +203,7 @@ private:
     std::string name;
     metric_unit unit;
 
+    // Only set for metrics added to the distributor directly, children of groups are reached through their group
     telemetry_distributor* owning_distributor;
 
     friend class telemetry_distributor;
@@ -318,12 +334,17 @@ public:
         }
     }
 
+    // Value over all lcores, as it is exported
+    value_type get_aggregated() {
+        return aggregator::convert(per_lcore_data, non_lcore_data);
+    }
+
 private:
     void serialize(json& v, const std::string& prefix) override {
 
         json value_obj;
 
-        serializer::convert(value_obj, aggregator::convert(per_lcore_data, non_lcore_data));
+        serializer::convert(value_obj, get_aggregated());
 
         v.push_back({{"label", prefix}, {"value", std::move(value_obj)}, {"unit", metric_base::get_unit_str(get_unit())}});
     }
@@ -333,6 +354,101 @@ private:
     storage_adapter  non_lcore_data;
 };
 
+/**
+ * @brief Per-lcore histogram with power of two buckets. Bucket 0 counts zeros, bucket i counts values in [2^(i-1), 2^i),
+ * the last bucket everything beyond. Serialized as one integer per bucket, labeled with its exclusive upper bound.
+ */
+template < size_t NUM_BUCKETS = 32 >
+class per_lcore_histogram_metric : public metric_base
+{
+public:
+    static_assert(NUM_BUCKETS > 1 && NUM_BUCKETS <= 64, "invalid number of histogram buckets");
+
+    explicit per_lcore_histogram_metric(std::string name, metric_unit unit = metric_unit::NONE) :
+        metric_base(std::move(name), unit) {
+
+        for(auto& v : per_lcore_data) {
+            v.buckets.fill(0);
+        }
+
+        non_lcore_data.buckets.fill(0);
+    }
+
+    ~per_lcore_histogram_metric() override = default;
+
+    __inline void record(uint64_t value) {
+        size_t bucket = value ? std::min< size_t >(64 - __builtin_clzll(value), NUM_BUCKETS - 1) : 0;
+
+        auto lid = rte_lcore_id();
+
+        if( lid == LCORE_ID_ANY ) {
+            ++non_lcore_data.buckets[bucket];
+        } else {
+            ++per_lcore_data[lid].buckets[bucket];
+        }
+    }
+
+private:
+    void serialize(json& v, const std::string& prefix) override {
+        std::array<uint64_t, NUM_BUCKETS> sum = non_lcore_data.buckets;
+
+        for(auto& lcore_data : per_lcore_data) {
+            for(size_t idx = 0; idx < NUM_BUCKETS; ++idx) {
+                sum[idx] += lcore_data.buckets[idx];
+            }
+        }
+
+        for(size_t idx = 0; idx < NUM_BUCKETS; ++idx) {
+            json value_obj;
+
+            metric_serializer<uint64_t>::convert(value_obj, sum[idx]);
+
+            std::string label = (idx + 1 < NUM_BUCKETS) ? fmt::format("{}::lt_{}", prefix, 1ULL << idx)
+                                                         : fmt::format("{}::inf", prefix);
+
+            v.push_back({{"label", std::move(label)}, {"value", std::move(value_obj)}, {"unit", metric_base::get_unit_str(get_unit())}});
+        }
+    }
+
+    struct alignas(RTE_CACHE_LINE_SIZE) bucket_data
+    {
+        std::array<uint64_t, NUM_BUCKETS> buckets;
+    };
+
+    std::array<bucket_data, RTE_MAX_LCORE> per_lcore_data;
+
+    bucket_data non_lcore_data;
+};
+
+/**
+ * @brief Quotient of two other metrics, computed when exported. Nothing is recorded here, so there is no cost on the
+ * datapath. Exported as 0 while the denominator is 0.
+ */
+template < class TNumerator, class TDenominator >
+class ratio_metric : public metric_base
+{
+public:
+    ratio_metric(std::string name, TNumerator& numerator, TDenominator& denominator, metric_unit unit = metric_unit::NONE) :
+        metric_base(std::move(name), unit), numerator(numerator), denominator(denominator) {}
+
+    ~ratio_metric() override = default;
+
+private:
+    void serialize(json& v, const std::string& prefix) override {
+        double den = (double) denominator.get_aggregated();
+
+        json value_obj;
+
+        metric_serializer<double>::convert(value_obj, den ? ((double) numerator.get_aggregated() / den) : 0.0);
+
+        v.push_back({{"label", prefix}, {"value", std::move(value_obj)}, {"unit", metric_base::get_unit_str(get_unit())}});
+    }
+
+    TNumerator& numerator;
+
+    TDenominator& denominator;
+};
+
 class metric_group : public metric_base
 {
 public:
@@ -0,0 +1,505 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#pragma once
+
+#include "common/common.hpp"
+#include "common/lua_common.hpp"
+#include "common/file_utils.hpp"
+
+#include "dpdk/dpdk_lua_arena.hpp"
+
+#include "flow_processor.hpp"
+
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include <unordered_map>
+
+
+struct lua_packet_accessor
+{
+    rte_mbuf* mbuf;
+
+    packet_private_info* packet_info;
+
+    flow_info_ipv4* flow_info;
+
+
+    void init(rte_mbuf* mb) {
+        mbuf = mb;
+
+        packet_info = get_private_packet_info(mbuf);
+
+        flow_info = packet_info->flow_info;
+    }
+
+    bool is_arp() const noexcept {
+        return (packet_info->ether_type == ether_type_info< RTE_ETHER_TYPE_ARP >::ether_type_be);
+    }
+
+    bool is_ipv4() const noexcept {
+        return (packet_info->ether_type == ether_type_info< RTE_ETHER_TYPE_IPV4 >::ether_type_be);
+    }
+
+    bool is_udp() const noexcept {
+        return is_ipv4() && (packet_info->ipv4_type == IP_PROTO_UDP);
+    }
+
+    bool is_tcp() const noexcept {
+        return is_ipv4() && (packet_info->ipv4_type == IP_PROTO_TCP);
+    }
+
+    bool is_icmp() const noexcept {
+        return is_ipv4() && (packet_info->ipv4_type == IP_PROTO_ICMP);
+    }
+
+    uint32_t get_dst_ipv4() const noexcept {
+        return (flow_info != nullptr) ? flow_info->dst_addr : 0;
+    }
+
+    uint32_t get_src_ipv4() const noexcept {
+        return (flow_info != nullptr) ? flow_info->src_addr : 0;
+    }
+
+    uint16_t get_src_endpoint() const noexcept {
+        return packet_info->src_endpoint_id;
+    }
+
+    uint16_t get_dst_endpoint() const noexcept {
+        return packet_info->dst_endpoint_id;
+    }
+
+    uint64_t get_flow_id() const noexcept {
+        return flow_info->flow_hash;
+    }
+
+    // The flow local storage seen as array of FLOW_LOCAL_STORAGE_SIZE / 8 integers. Out of range or flowless reads give 0
+    uint64_t get_flow_value(uint32_t idx) const noexcept {
+        if ( !flow_info || idx >= FLOW_LOCAL_STORAGE_SLOTS ) {
+            return 0;
+        }
+
+        return reinterpret_cast< const uint64_t* >(get_flow_local_storage(flow_info))[idx];
+    }
+
+    void set_flow_value(uint32_t idx, uint64_t value) noexcept {
+        if ( !flow_info || idx >= FLOW_LOCAL_STORAGE_SLOTS ) {
+            return;
+        }
+
+        reinterpret_cast< uint64_t* >(get_flow_local_storage(flow_info))[idx] = value;
+    }
+
+    static constexpr uint32_t FLOW_LOCAL_STORAGE_SLOTS = FLOW_LOCAL_STORAGE_SIZE / sizeof(uint64_t);
+
+    // Payload access. Offsets are counted from the start of the frame and may cross segment boundaries. Nothing is
+    // copied into lua except the values read.
+    uint32_t get_len() const noexcept {
+        return rte_pktmbuf_pkt_len(mbuf);
+    }
+
+    uint16_t get_l3_offset() const noexcept {
+        return packet_info->l3_offset;
+    }
+
+    uint16_t get_l4_offset() const noexcept {
+        return packet_info->l4_offset;
+    }
+
+    // First byte after the TCP/UDP header. Same as the l4 offset for everything else
+    uint32_t get_payload_offset() const noexcept {
+        if ( is_udp() ) {
+            return packet_info->l4_offset + sizeof(rte_udp_hdr);
+        }
+
+        uint8_t data_off;
+
+        if ( is_tcp() && packet_read_be(mbuf, packet_info->l4_offset + offsetof(rte_tcp_hdr, data_off), data_off) ) {
+            return packet_info->l4_offset + ((data_off >> 4) * 4);
+        }
+
+        return packet_info->l4_offset;
+    }
+
+    template < class T >
+    sol::optional< uint32_t > read(uint32_t offset) const noexcept {
+        T value;
+
+        if ( !packet_read_be(mbuf, offset, value) ) {
+            return sol::nullopt;
+        }
+
+        return value;
+    }
+
+    bool equals(uint32_t offset, std::string_view data) const noexcept {
+        return packet_compare(mbuf, offset, data.data(), data.size());
+    }
+
+    sol::optional< uint32_t > find(std::string_view needle,
+                                   sol::optional< uint32_t > offset,
+                                   sol::optional< uint32_t > max_len) const noexcept {
+        int64_t pos = packet_find(mbuf, offset.value_or(0), max_len.value_or(UINT32_MAX), needle.data(), needle.size());
+
+        if ( pos < 0 ) {
+            return sol::nullopt;
+        }
+
+        return (uint32_t) pos;
+    }
+};
+
+/**
+ * @brief Plain packet view handed to scripts running in FFI mode.
+ * The layout is mirrored by the lua_packet_view cdef in lua_ffi.lua.
+ */
+struct lua_packet_view
+{
+    rte_mbuf* mbuf;
+
+    packet_private_info* info;
+
+    flow_info_ipv4* flow;
+
+    // Flow local storage of flow. nullptr if the packet has no flow
+    uint8_t* storage;
+
+    uint8_t* data;
+
+    // Length of the first segment. Everything beyond that is not directly accessible through data
+    uint32_t data_len;
+
+    uint32_t pkt_len;
+
+    __inline void init(rte_mbuf* mb) noexcept {
+        mbuf     = mb;
+        info     = get_private_packet_info(mb);
+        flow     = info->flow_info;
+        storage  = flow ? get_flow_local_storage(flow) : nullptr;
+        data     = rte_pktmbuf_mtod(mb, uint8_t*);
+        data_len = rte_pktmbuf_data_len(mb);
+        pkt_len  = rte_pktmbuf_pkt_len(mb);
+    }
+};
+
+/**
+ * @brief Integer keyed map of numbers that the control vm publishes and the datapath vms read. Publishing replaces the
+ * whole snapshot, readers never lock and see either the old or the new one. Old snapshots are freed after an rcu grace
+ * period.
+ */
+struct lua_shared_map
+{
+    using snapshot = std::unordered_map< uint64_t, double >;
+
+    explicit lua_shared_map(std::string name) : name(std::move(name)), current(nullptr) {}
+
+    std::string name;
+
+    std::atomic< const snapshot* > current;
+
+    // Owner of current. Only touched by the control thread
+    std::unique_ptr< const snapshot > owned;
+};
+
+class lua_packet_filter;
+
+/**
+ * @brief What scripts get from shared_map(name). Only the handles of the control vm can publish.
+ */
+struct lua_shared_map_handle
+{
+    lua_packet_filter* filter;
+
+    lua_shared_map* map;
+
+    bool writable;
+
+    sol::optional< double > get(uint64_t key) const noexcept {
+        const lua_shared_map::snapshot* values = map->current.load(std::memory_order_acquire);
+
+        if ( !values ) {
+            return sol::nullopt;
+        }
+
+        auto it = values->find(key);
+
+        if ( it == values->end() ) {
+            return sol::nullopt;
+        }
+
+        return it->second;
+    }
+
+    size_t size() const noexcept {
+        const lua_shared_map::snapshot* values = map->current.load(std::memory_order_acquire);
+
+        return values ? values->size() : 0;
+    }
+
+    // Takes a table of integer keys and number values. Blocks until no lcore can see the previous snapshot anymore
+    void publish(sol::table values);
+};
+
+/**
+ * @brief Periodic callback registered by add_timer. Only ever run by the control vm.
+ */
+struct lua_timer
+{
+    uint64_t interval_cycles;
+
+    uint64_t next_run;
+
+    sol::function callback;
+};
+
+/**
+ * @brief Everything that belongs to one lua state of a lua_packet_filter. A lua state must never be entered by more
+ * than one thread so there is one of these per lcore that runs the filter.
+ */
+struct lua_filter_vm
+{
+    lua_filter_vm() = default;
+
+    explicit lua_filter_vm(std::unique_ptr< dpdk_lua_arena > vm_arena) :
+        arena(std::move(vm_arena)), lua(&dpdk_lua_arena::alloc, arena.get()) {}
+
+    // Only set if the vm lives in hugepage memory. Must outlive lua
+    std::unique_ptr< dpdk_lua_arena > arena;
+
+    lua_engine lua;
+
+    // Script generation this vm was created from. Tags the verdicts cached under eval_flow_once
+    uint32_t epoch;
+
+    // Generation of the script this one replaced on reload, 0 if none
+    uint32_t previous_epoch;
+
+    // Runs on the control thread instead of an lcore. Only this one runs timers and may publish shared maps
+    bool is_control;
+
+    // Registered by every vm, run only by the control vm
+    std::vector< lua_timer > timers;
+
+    sol::function process_function;
+
+    // Optional burst entry point. Only valid if the script defines process_burst
+    sol::function process_burst_function;
+
+    bool use_burst_function;
+
+    // Optional flow hooks. Not called per packet
+    sol::function new_flow_function;
+
+    sol::function flow_expire_function;
+
+    // __ffi_cast from lua_ffi.lua. Only valid in ffi mode
+    sol::function ffi_cast_function;
+
+    // Lua table holding references to burst_accessors. Created once, the accessors get updated in place
+    sol::table burst_packets;
+
+    sol::table burst_verdicts;
+
+    // Packet or flow group index per entry of burst_accessors
+    std::array< uint16_t, MAX_BURST_SIZE > burst_targets;
+
+    std::array< lua_packet_accessor, MAX_BURST_SIZE > burst_accessors;
+
+    // lua_packet_view* and int32_t* cdata pointing to burst_views and burst_verdict_values
+    sol::object ffi_views;
+
+    sol::object ffi_verdicts;
+
+    std::array< lua_packet_view, MAX_BURST_SIZE > burst_views;
+
+    std::array< int32_t, MAX_BURST_SIZE > burst_verdict_values;
+};
+
+class lua_packet_filter : public flow_processor
+{
+public:
+    lua_packet_filter(std::string                      name,
+                    std::shared_ptr< dpdk_packet_mempool >  mempool,
+                    std::shared_ptr< flow_database > flow_database_ptr);
+
+    ~lua_packet_filter() override;
+
+    uint16_t process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) override;
+
+    void init(const flow_proc_builder& builder) override;
+
+    void lcore_init(uint32_t lcore_id) override;
+
+    void control_poll() override;
+
+#if TELEMETRY_ENABLED == 1
+    void init_telemetry(telemetry_distributor& telemetry) override;
+#endif
+
+private:
+    void evaluate_packets(lua_filter_vm& vm, mbuf_vec_base& mbuf_vec, flow_proc_context& ctx);
+
+    uint16_t evaluate(lua_filter_vm& vm, lua_packet_accessor& packet_accessor);
+
+    void evaluate_burst(lua_filter_vm&          vm,
+                        mbuf_vec_base&          mbuf_vec,
+                        const flow_group_table& flow_groups,
+                        bool                    per_group);
+
+    std::unique_ptr< lua_filter_vm > create_vm(const std::string& bytecode,
+                                               uint32_t           epoch,
+                                               int                socket_id,
+                                               bool               is_control = false);
+
+    lua_shared_map& get_shared_map(const std::string& map_name);
+
+    void publish_shared_map(lua_shared_map& map, std::unique_ptr< const lua_shared_map::snapshot > values);
+
+    void run_timers();
+
+    void reload_script();
+
+    void gc_step(lua_filter_vm& vm);
+
+    void record_call(uint64_t start_cycles, bool call_ok);
+
+    void record_verdict(int verdict);
+
+    void install_trace_hook(lua_filter_vm& vm);
+
+    void init_ffi(lua_filter_vm& vm);
+
+    bool lookup_flow_verdict(lua_filter_vm& vm, lua_packet_accessor& packet_accessor, uint16_t& dst_endpoint_id);
+
+    sol::table create_flow_table(lua_filter_vm& vm, const flow_info_ipv4& info, uint8_t* storage);
+
+    void poll_new_flows();
+
+    void poll_expired_flows();
+
+    std::shared_ptr< flow_database > flow_database_ptr;
+
+    bool eval_flow_once;
+
+    bool group_by_flow;
+
+    // Scripts get cdata views instead of the packet usertype
+    bool use_ffi;
+
+    // The automatic collector is stopped in every vm. Instead the gc gets this many incremental steps after each burst
+    uint32_t gc_steps_per_burst;
+
+    // Not a limit: above it the gc of a vm gets more steps per burst. 0 disables the boost. See lua_memory_limit_kb
+    uint32_t gc_boost_threshold_kb;
+
+    // on_new_flow runs on the control thread instead of the datapath. Undecided flows get new_flow_verdict meanwhile
+    bool defer_new_flows;
+
+    int new_flow_verdict;
+
+    // Every vm gets its own dpdk_lua_arena on the NUMA node of the lcore running it
+    bool use_lua_arena;
+
+    // Hard limit per arena. Allocations beyond it fail inside the script
+    uint32_t lua_memory_limit_kb;
+
+    std::string script_filename;
+
+    // Every vm is created from this. Replaced on reload. Shared with other filters running the same script
+    lua_bytecode_cache::bytecode_ptr script_bytecode;
+
+    // Only set if the script should be reloaded on change
+    std::unique_ptr< filesystem_watcher > script_watcher;
+
+    // Published as read only table "config" in every vm. Filled from all params prefixed with "config."
+    lua_shared_table shared_config;
+
+    // Guards everything below except active_vms
+    std::mutex vm_lock;
+
+    uint32_t vm_epoch;
+
+    uint32_t previous_vm_epoch;
+
+    // Created by init to validate the script. Handed over to the first lcore lcore_init is called for unless the vms use
+    // arenas, which have to be on the socket of the lcore
+    std::unique_ptr< lua_filter_vm > initial_vm;
+
+    // Owner of the vms. Only touched on the control path
+    std::array< std::unique_ptr< lua_filter_vm >, RTE_MAX_LCORE > lcore_vms;
+
+    // Runs the deferred on_new_flow calls and on_flow_expire. Only touched by the control thread
+    std::unique_ptr< lua_filter_vm > control_vm;
+
+    std::unique_ptr< rte_ring, dpdk_ring_deleter > new_flow_ring;
+
+    // Owned by the flow database
+    rte_ring* flow_expire_ring;
+
+    // What the datapath actually uses. Swapped on reload, the old vm is freed after an rcu grace period
+    std::array< std::atomic< lua_filter_vm* >, RTE_MAX_LCORE > active_vms;
+
+    // Created on first use by any vm. Never removed, handles in the datapath vms point right into them
+    std::vector< std::unique_ptr< lua_shared_map > > shared_maps;
+
+    // Guards shared_maps. The maps themselves are lock free
+    std::mutex shared_map_lock;
+
+    friend struct lua_shared_map_handle;
+
+#if TELEMETRY_ENABLED == 1
+    metric_group filter_metric_grp;
+
+    per_lcore_metric< uint64_t > m_gc_steps;
+
+    per_lcore_metric< uint64_t > m_gc_cycles;
+
+    per_lcore_metric< uint64_t, trivial_storage_adapter< uint64_t >, metric_serializer< uint64_t >, max_aggregator< uint64_t > >
+        m_gc_max_pause_cycles;
+
+    per_lcore_metric< uint64_t > m_gc_memory_kb;
+
+    per_lcore_metric< uint64_t > m_gc_boost;
+
+    // Calls into the script. One per packet/flow for process, one per burst for process_burst
+    per_lcore_metric< uint64_t > m_invocations;
+
+    per_lcore_histogram_metric<> m_call_cycles;
+
+    per_lcore_metric< uint64_t > m_errors;
+
+    per_lcore_metric< uint64_t > m_verdict_forward;
+
+    per_lcore_metric< uint64_t > m_verdict_drop;
+
+    per_lcore_metric< uint64_t > m_verdict_broadcast;
+
+    // The script returned something that leaves the destination untouched
+    per_lcore_metric< uint64_t > m_verdict_pass;
+
+    // Answered from the flow entry under eval_flow_once without calling the script
+    per_lcore_metric< uint64_t > m_verdict_cached;
+
+    per_lcore_metric< uint64_t > m_trace_started;
+
+    per_lcore_metric< uint64_t > m_trace_compiled;
+
+    per_lcore_metric< uint64_t > m_trace_aborted;
+
+    per_lcore_metric< uint64_t > m_trace_flushed;
+
+    per_lcore_metric< uint64_t > m_new_flows_deferred;
+
+    // The new flow ring was full. These flows never see on_new_flow
+    per_lcore_metric< uint64_t > m_new_flows_lost;
+
+    per_lcore_metric< uint64_t > m_flows_expired;
+
+    // The expire ring was full. Total since the subscription, kept by the flow database
+    per_lcore_metric< uint64_t > m_flow_expire_events_lost;
+#endif
+};
@@ -0,0 +1,161 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#pragma once
+
+#include "common/common.hpp"
+#include "common/network_utils.hpp"
+
+#include <optional>
+
+
+/**
+ * @brief Packet fields a rule can match on. Filled once per packet, the decision function only ever reads from here.
+ */
+struct rule_match_key
+{
+    // Host byte order
+    uint32_t src_addr;
+    uint32_t dst_addr;
+
+    // Host byte order. 0 if the packet is neither TCP nor UDP
+    uint16_t src_port;
+    uint16_t dst_port;
+
+    // 0 if the packet was untagged
+    uint16_t vlan;
+
+    uint16_t src_endpoint_id;
+
+    uint8_t proto;
+
+    // If 0, addresses, ports and proto are 0 as well
+    uint8_t is_ipv4;
+};
+
+struct rule_verdict
+{
+    // Collected from all matching mark rules
+    uint64_t mark_bits;
+
+    // Set by the first matching terminal rule. PORT_ID_IGNORE if no terminal rule matched or the rule said pass
+    uint16_t dst_endpoint_id;
+};
+
+enum class rule_action_type
+{
+    PASS,
+    DROP,
+    FORWARD,
+    BROADCAST,
+    MULTICAST,
+    MARK
+};
+
+struct rule_prefix_match
+{
+    uint32_t addr;
+    uint32_t mask;
+};
+
+struct rule_range_match
+{
+    uint16_t first;
+    uint16_t last;
+};
+
+struct match_rule
+{
+    std::optional< rule_prefix_match > src_addr;
+    std::optional< rule_prefix_match > dst_addr;
+
+    std::optional< rule_range_match > src_port;
+    std::optional< rule_range_match > dst_port;
+
+    std::optional< uint8_t > proto;
+
+    std::optional< uint16_t > vlan;
+
+    std::optional< uint16_t > src_endpoint_id;
+
+    rule_action_type action;
+
+    // Destination endpoint for FORWARD, group for MULTICAST, bit index for MARK
+    uint16_t action_arg;
+
+    // Line within the rule source. Only used for error messages
+    size_t line;
+
+    bool needs_ipv4() const noexcept {
+        return src_addr || dst_addr || src_port || dst_port || proto;
+    }
+
+    bool is_terminal() const noexcept {
+        return action != rule_action_type::MARK;
+    }
+
+    bool matches(const rule_match_key& key) const noexcept;
+};
+
+/**
+ * @brief Parses the textual rule language. One rule per line, '#' starts a comment:
+ *
+ *     [match...] -> action [arg]
+ *
+ * Matches: src_ip <a.b.c.d[/len]>, dst_ip <a.b.c.d[/len]>, src_port <n[-m]>, dst_port <n[-m]>,
+ * proto <tcp|udp|icmp|n>, vlan <n>, src_endpoint <n> or any. All matches of a rule must hold.
+ * Actions: drop, broadcast, pass, forward <endpoint>, multicast <group>, mark <bit>. Rules are evaluated in order. mark sets a bit in
+ * the flow mark and continues with the next rule, every other action ends the evaluation.
+ * Throws on malformed input.
+ */
+std::vector< match_rule > parse_rules(const std::string& source);
+
+
+/**
+ * @brief Turns a list of rules into one native decision function. Falls back to interpreting the rule list if no JIT
+ * is available or code generation fails.
+ */
+class compiled_rule_set : noncopyable
+{
+public:
+    using decision_func = void (*)(const rule_match_key* key, rule_verdict* verdict);
+
+    explicit compiled_rule_set(std::vector< match_rule > rules, bool allow_jit = true);
+
+    ~compiled_rule_set();
+
+    __inline void evaluate(const rule_match_key& key, rule_verdict& verdict) const noexcept {
+        verdict.mark_bits       = 0;
+        verdict.dst_endpoint_id = PORT_ID_IGNORE;
+
+        if ( likely(func != nullptr) ) {
+            func(&key, &verdict);
+        } else {
+            interpret(key, verdict);
+        }
+    }
+
+    void interpret(const rule_match_key& key, rule_verdict& verdict) const noexcept;
+
+    bool is_native() const noexcept {
+        return func != nullptr;
+    }
+
+    size_t size() const noexcept {
+        return rules.size();
+    }
+
+private:
+    bool compile();
+
+    std::vector< match_rule > rules;
+
+    decision_func func;
+
+    struct jit_data;
+
+    std::unique_ptr< jit_data > jit;
+};
@@ -0,0 +1,34 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#pragma once
+
+#include "common/common.hpp"
+
+#include "flow_processor.hpp"
+#include "rule_compiler.hpp"
+
+
+/**
+ * @brief Applies a static rule list (see parse_rules) to every packet without involving a lua vm. The rules are
+ * either given inline via the "rules" param or loaded from "rules_filename".
+ */
+class rule_filter : public flow_processor
+{
+public:
+    rule_filter(std::string                            name,
+                std::shared_ptr< dpdk_packet_mempool > mempool,
+                std::shared_ptr< flow_database >       flow_database_ptr);
+
+    ~rule_filter() override = default;
+
+    uint16_t process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) override;
+
+    void init(const flow_proc_builder& builder) override;
+
+private:
+    std::unique_ptr< compiled_rule_set > rule_set;
+};
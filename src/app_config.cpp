@@ -15,11 +15,15 @@
 app_config::app_config() noexcept :
     primary_pkt_allocator_capacity(4096, "packet_allocator_capacity", min_max_limits< size_t >(0, 65536)),
     primary_pkt_allocator_cache_size(64, "packet_allocator_cache_size", min_max_limits< size_t >(0, 256)),
-    flowtable_capacity(8192, "flowtable_capacity", min_max_limits< size_t >(0, 65536)) {
+    flowtable_capacity(8192, "flowtable_capacity", min_max_limits< size_t >(0, 65536)),
+    burst_size(32, "burst_size", min_max_limits< size_t >(1, MAX_BURST_SIZE)),
+    burst_size_min(32, "burst_size_min", min_max_limits< size_t >(1, MAX_BURST_SIZE)) {
 
     dataplane_config_params.push_back(std::ref(primary_pkt_allocator_capacity));
     dataplane_config_params.push_back(std::ref(primary_pkt_allocator_cache_size));
     dataplane_config_params.push_back(std::ref(flowtable_capacity));
+    dataplane_config_params.push_back(std::ref(burst_size));
+    dataplane_config_params.push_back(std::ref(burst_size_min));
 }
 
 void app_config::load_from_toml(const std::filesystem::path& cfg_file_path) {
@@ -7,6 +7,14 @@
 #include <common/file_utils.hpp>
 
 #include <fstream>
+#include <map>
+#include <set>
+
+#include <cstring>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 std::string load_file_as_string(const std::filesystem::path& file_path) {
     if ( exists(file_path) ) {
@@ -34,23 +42,96 @@ std::string load_file_as_string(const std::filesystem::path& file_path) {
     }
 }
 
+filesystem_watch::filesystem_watch(std::filesystem::path path) : path(std::filesystem::absolute(path)) {}
+
+std::filesystem::path filesystem_watch::get_directory() const {
+    return path.parent_path();
+}
+
+std::string filesystem_watch::get_filename() const {
+    return path.filename().string();
+}
+
+
 struct filesystem_watcher::private_data
 {
+    fdescriptor::fdtype inotify_fd;
 
+    // Watch descriptor of each watched directory and the file names we care about within that directory
+    std::map< int, std::pair< std::filesystem::path, std::set< std::string > > > watched_dirs;
 };
 
-filesystem_watcher::filesystem_watcher() {
+filesystem_watcher::filesystem_watcher() : pdata(std::make_unique< private_data >()) {
+    pdata->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 
+    if ( pdata->inotify_fd < 0 ) {
+        throw std::runtime_error(fmt::format("could not init inotify: {}", strerror(errno)));
+    }
 }
 
 filesystem_watcher::~filesystem_watcher() {
+    if ( pdata->inotify_fd >= 0 ) {
+        close(pdata->inotify_fd);
+    }
+}
+
+void filesystem_watcher::add_watch(const filesystem_watch& watch) {
+    std::filesystem::path directory = watch.get_directory();
+
+    // Adding the same directory twice returns the existing watch descriptor
+    int wd = inotify_add_watch(
+        pdata->inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+
+    if ( wd < 0 ) {
+        throw std::runtime_error(fmt::format("could not watch {}: {}", directory.string(), strerror(errno)));
+    }
+
+    auto& watched_dir = pdata->watched_dirs[wd];
 
+    watched_dir.first = directory;
+    watched_dir.second.insert(watch.get_filename());
 }
 
 fdescriptor::fdtype filesystem_watcher::get_fd() const {
-    return fdescriptor::INVALID_FD;
+    return pdata->inotify_fd;
 }
 
 bool filesystem_watcher::wait(uint32_t fd_op_flags, uint32_t timeout_ms) {
-    return false;
+    pollfd pfd {pdata->inotify_fd, POLLIN, 0};
+
+    return (poll(&pfd, 1, (int) timeout_ms) > 0) && (pfd.revents & POLLIN);
+}
+
+std::vector< std::filesystem::path > filesystem_watcher::poll_changes() {
+    std::set< std::filesystem::path > changed;
+
+    alignas(inotify_event) char buffer[4096];
+
+    for ( ;; ) {
+        ssize_t len = read(pdata->inotify_fd, buffer, sizeof(buffer));
+
+        if ( len <= 0 ) {
+            break;
+        }
+
+        for ( ssize_t offset = 0; offset < len; ) {
+            const auto* event = reinterpret_cast< const inotify_event* >(buffer + offset);
+
+            offset += sizeof(inotify_event) + event->len;
+
+            auto dir_it = pdata->watched_dirs.find(event->wd);
+
+            if ( dir_it == pdata->watched_dirs.end() || !event->len ) {
+                continue;
+            }
+
+            std::string filename(event->name);
+
+            if ( dir_it->second.second.count(filename) ) {
+                changed.insert(dir_it->second.first / filename);
+            }
+        }
+    }
+
+    return {changed.begin(), changed.end()};
 }
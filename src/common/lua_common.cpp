@@ -7,6 +7,8 @@
 #include <common/lua_common.hpp>
 #include "lua_utils.h"
 
+#include <cstdlib>
+
 lua_attachment_base::~lua_attachment_base() {
     if ( engine ) {
         engine->detach_all(*this);
@@ -16,7 +18,29 @@ lua_attachment_base::~lua_attachment_base() {
 }
 
 
-lua_engine::lua_engine() {
+static sol::state create_lua_state(lua_Alloc alloc_func, void* alloc_ud, bool& custom_allocator) {
+    custom_allocator = false;
+
+    if ( alloc_func ) {
+        // lua_newstate just returns null if the allocator is not supported
+        lua_State* probe = lua_newstate(alloc_func, alloc_ud);
+
+        if ( probe ) {
+            lua_close(probe);
+
+            custom_allocator = true;
+
+            return sol::state(sol::default_at_panic, alloc_func, alloc_ud);
+        }
+
+        log(LOG_WARN, "lua runtime does not support custom allocators. Using the default allocator instead");
+    }
+
+    return sol::state();
+}
+
+lua_engine::lua_engine(lua_Alloc alloc_func, void* alloc_ud) :
+    state(create_lua_state(alloc_func, alloc_ud, custom_allocator)) {
 
     state.set_exception_handler(lua_engine::_binding_exception_handler);
 
@@ -36,11 +60,11 @@ void lua_engine::load_stdlibs() {
     state.open_libraries(sol::lib::package, sol::lib::base, sol::lib::string, sol::lib::io, sol::lib::math, sol::lib::jit);
 }
 
-void lua_engine::execute(const std::string& script, const std::string& script_name) {
+void lua_engine::execute(const std::string& script, const std::string& script_name, sol::load_mode mode) {
     std::lock_guard< std::mutex > guard(resource_lock);
 
     try {
-        auto result = state.safe_script(script, script_name, sol::load_mode::text);
+        auto result = state.safe_script(script, script_name, mode);
 
         if(!result.valid()) {
             sol::error err = result;
@@ -52,6 +76,86 @@ void lua_engine::execute(const std::string& script, const std::string& script_na
     }
 }
 
+std::string lua_engine::compile(const std::string& script, const std::string& script_name) {
+    std::lock_guard< std::mutex > guard(resource_lock);
+
+    lua_State* L = state.lua_state();
+
+    if ( luaL_loadbuffer(L, script.data(), script.size(), script_name.c_str()) != 0 ) {
+        std::string msg = lua_tostring(L, -1);
+
+        lua_pop(L, 1);
+
+        throw std::runtime_error(fmt::format("could not compile {}: {}", script_name, msg));
+    }
+
+    std::string bytecode;
+
+    int rc = lua_dump(
+        L,
+        [](lua_State*, const void* p, size_t size, void* ud) -> int {
+            static_cast< std::string* >(ud)->append(static_cast< const char* >(p), size);
+
+            return 0;
+        },
+        &bytecode);
+
+    lua_pop(L, 1);
+
+    if ( rc != 0 ) {
+        throw std::runtime_error(fmt::format("could not dump bytecode of {}", script_name));
+    }
+
+    return bytecode;
+}
+
+lua_bytecode_cache& lua_bytecode_cache::instance() {
+    static lua_bytecode_cache cache;
+
+    return cache;
+}
+
+lua_bytecode_cache::bytecode_ptr lua_bytecode_cache::get_or_compile(const std::string& script,
+                                                                    const std::string& script_name) {
+    size_t script_hash = std::hash< std::string > {}(script);
+
+    std::lock_guard< std::mutex > guard(cache_lock);
+
+    auto range = entries.equal_range(script_hash);
+
+    for ( auto it = range.first; it != range.second; ) {
+        bytecode_ptr bytecode = it->second.bytecode.lock();
+
+        if ( !bytecode ) {
+            it = entries.erase(it);
+
+            continue;
+        }
+
+        if ( it->second.script == script && it->second.script_name == script_name ) {
+            ++hits;
+
+            log(LOG_DEBUG, "using cached bytecode for {}", script_name);
+
+            return bytecode;
+        }
+
+        ++it;
+    }
+
+    ++misses;
+
+    // Compiling happens under the lock on purpose. Filters created in parallel from the same script then wait for the
+    // first compilation instead of all compiling it themselves
+    lua_engine compiler;
+
+    auto bytecode = std::make_shared< const std::string >(compiler.compile(script, script_name));
+
+    entries.emplace(script_hash, cache_entry {script, script_name, bytecode});
+
+    return bytecode;
+}
+
 void lua_engine::detach_all(lua_attachment_base& attachment) {
     std::lock_guard< std::mutex > guard(resource_lock);
 }
@@ -87,3 +191,50 @@ int lua_engine::_binding_exception_handler(lua_State*
 
     return sol::stack::push(L, description);
 }
+
+
+static int lua_shared_table_newindex(lua_State* L) {
+    return luaL_error(L, "shared table is read only");
+}
+
+void lua_shared_table::set(const std::string& key, value_type value) {
+    entries[key] = std::move(value);
+}
+
+void lua_shared_table::set_from_string(const std::string& key, const std::string& value) {
+    if ( value == "true" || value == "false" ) {
+        set(key, value == "true");
+
+        return;
+    }
+
+    char*  end    = nullptr;
+    double number = std::strtod(value.c_str(), &end);
+
+    if ( !value.empty() && end == (value.c_str() + value.size()) ) {
+        set(key, number);
+    } else {
+        set(key, value);
+    }
+}
+
+void lua_shared_table::publish(lua_engine& engine, const char* name) const {
+    sol::state& state = engine.get();
+
+    sol::table data = state.create_table(0, (int) entries.size());
+
+    for ( const auto& [key, value] : entries ) {
+        std::visit([&data, &key = key](const auto& v) { data[key] = v; }, value);
+    }
+
+    // Empty proxy so that every write ends up in __newindex
+    sol::table proxy = state.create_table();
+    sol::table meta  = state.create_table();
+
+    meta["__index"]    = data;
+    meta["__newindex"] = &lua_shared_table_newindex;
+
+    proxy[sol::metatable_key] = meta;
+
+    state[name] = proxy;
+}
@@ -44,6 +44,96 @@ bool calc_flow_hash(rte_mbuf* mbuf, flow_hash* flow_hash) {
     return true;
 }
 
+bool packet_compare(const rte_mbuf* mbuf, uint32_t offset, const void* data, uint32_t len) {
+    if ( ((uint64_t) offset + len) > rte_pktmbuf_pkt_len(mbuf) ) {
+        return false;
+    }
+
+    if ( !len ) {
+        return true;
+    }
+
+    const rte_mbuf* seg = mbuf;
+
+    while ( offset >= seg->data_len ) {
+        offset -= seg->data_len;
+        seg = seg->next;
+    }
+
+    const auto* cmp_data = static_cast< const uint8_t* >(data);
+
+    while ( len ) {
+        uint32_t chunk_len = std::min< uint32_t >(len, seg->data_len - offset);
+
+        if ( std::memcmp(rte_pktmbuf_mtod_offset(seg, const uint8_t*, offset), cmp_data, chunk_len) != 0 ) {
+            return false;
+        }
+
+        cmp_data += chunk_len;
+        len -= chunk_len;
+        offset = 0;
+        seg    = seg->next;
+    }
+
+    return true;
+}
+
+int64_t packet_find(const rte_mbuf* mbuf, uint32_t offset, uint32_t max_len, const void* needle, uint32_t needle_len) {
+    uint32_t pkt_len = rte_pktmbuf_pkt_len(mbuf);
+
+    if ( !needle_len || offset >= pkt_len ) {
+        return -1;
+    }
+
+    uint32_t end = (uint32_t) std::min< uint64_t >((uint64_t) offset + max_len, pkt_len);
+
+    if ( (end - offset) < needle_len ) {
+        return -1;
+    }
+
+    // Last position a match can start at
+    uint32_t last_start = end - needle_len;
+
+    const auto* needle_data = static_cast< const uint8_t* >(needle);
+
+    const rte_mbuf* seg       = mbuf;
+    uint32_t        seg_start = 0;
+    uint32_t        pos       = offset;
+
+    while ( pos <= last_start ) {
+        // Move on to the segment that contains pos
+        while ( (pos - seg_start) >= seg->data_len ) {
+            seg_start += seg->data_len;
+            seg = seg->next;
+        }
+
+        const uint8_t* seg_data = rte_pktmbuf_mtod(seg, const uint8_t*);
+
+        uint32_t search_begin = pos - seg_start;
+        uint32_t search_end   = std::min< uint32_t >(seg->data_len, last_start - seg_start + 1);
+
+        // Only the first byte is searched within the segment, the rest is compared wherever it lies
+        const auto* hit = static_cast< const uint8_t* >(
+            std::memchr(seg_data + search_begin, needle_data[0], search_end - search_begin));
+
+        if ( !hit ) {
+            pos = seg_start + search_end;
+
+            continue;
+        }
+
+        uint32_t hit_pos = seg_start + (uint32_t) (hit - seg_data);
+
+        if ( packet_compare(mbuf, hit_pos + 1, needle_data + 1, needle_len - 1) ) {
+            return hit_pos;
+        }
+
+        pos = hit_pos + 1;
+    }
+
+    return -1;
+}
+
 std::string ipv4_to_str(uint32_t ipv4) {
     uint8_t tmp[sizeof(uint32_t)];
 
@@ -31,6 +31,10 @@ void dpdk_memzone_deleter::operator()(const rte_memzone* memzone) {
     rte_memzone_free(memzone);
 }
 
+void dpdk_ring_deleter::operator()(rte_ring* ring) {
+    rte_ring_free(ring);
+}
+
 std::string lcore_info::to_string() const {
     return fmt::format("core {} on node {}", get_lcore_id(), get_socket_id());
 }
@@ -142,9 +146,8 @@ int dpdk_packet_mempool::bulk_alloc(mbuf_vec_base& mbuf_vec, uint16_t count) {
 }
 
 void dpdk_packet_mempool::bulk_free(rte_mbuf** mbufs, uint16_t count) {
-    for ( uint16_t index = 0; index < count; ++index ) {
-        rte_pktmbuf_free(mbufs[index]);
-    }
+    // Returns the segments to their pools in batches and skips null entries
+    rte_pktmbuf_free_bulk(mbufs, count);
 }
 
 mbuf_ring::mbuf_ring(std::string name, int socket_id) : name(std::move(name)), socket_id(socket_id) {}
@@ -40,7 +40,9 @@ dpdk_ethdev::dpdk_ethdev(uint64_t                        port_id,
     this->port_id = port_id;
     this->offload_flags = offload_flags;
 
-    if ( local_dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE ) {
+    // Only valid if every transmitted mbuf has a reference count of one, which broadcast and multicast packets don't
+    if ( (offload_flags & DEV_TX_OFFLOAD_MBUF_FAST_FREE) &&
+         (local_dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE) ) {
         log(LOG_DEBUG, "Device {}: Enabled DEV_TX_OFFLOAD_MBUF_FAST_FREE", port_id);
         local_dev_conf.txmode.offloads |= DEV_TX_OFFLOAD_MBUF_FAST_FREE;
     }
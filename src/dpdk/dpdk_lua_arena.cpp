@@ -0,0 +1,211 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#include <dpdk/dpdk_lua_arena.hpp>
+
+#include <rte_malloc.h>
+
+#include <cstring>
+
+
+dpdk_lua_arena::dpdk_lua_arena(int socket_id, size_t limit_bytes) :
+    socket_id(socket_id),
+    limit(limit_bytes),
+    used(0),
+    reserved(0),
+    failed_allocations(0),
+    chunk_pos(nullptr),
+    chunk_end(nullptr) {
+
+    free_lists.fill(nullptr);
+}
+
+dpdk_lua_arena::~dpdk_lua_arena() {
+    // Large blocks are owned by the lua state and have been released by lua_close already
+    for ( void* chunk : chunks ) {
+        rte_free(chunk);
+    }
+}
+
+void* dpdk_lua_arena::alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+    auto* arena = static_cast< dpdk_lua_arena* >(ud);
+
+    if ( nsize == 0 ) {
+        if ( ptr ) {
+            arena->deallocate(ptr, osize);
+        }
+
+        return nullptr;
+    }
+
+    if ( !ptr ) {
+        return arena->allocate(nsize);
+    }
+
+    return arena->reallocate(ptr, osize, nsize);
+}
+
+bool dpdk_lua_arena::reserve(size_t size, bool ignore_limit) {
+    if ( limit && !ignore_limit && (reserved + size) > limit ) {
+        ++failed_allocations;
+
+        return false;
+    }
+
+    reserved += size;
+
+    return true;
+}
+
+void* dpdk_lua_arena::refill(size_t size_class, bool ignore_limit) {
+    size_t class_size = get_class_size(size_class);
+
+    if ( (size_t) (chunk_end - chunk_pos) < class_size ) {
+        // Hand the rest of the old chunk to the smaller classes instead of wasting it
+        for ( size_t idx = size_class; idx-- > 0 && chunk_pos != chunk_end; ) {
+            while ( (size_t) (chunk_end - chunk_pos) >= get_class_size(idx) ) {
+                auto* block = reinterpret_cast< free_block* >(chunk_pos);
+
+                block->next    = free_lists[idx];
+                free_lists[idx] = block;
+
+                chunk_pos += get_class_size(idx);
+            }
+        }
+
+        if ( !reserve(CHUNK_SIZE, ignore_limit) ) {
+            return nullptr;
+        }
+
+        void* chunk = rte_malloc_socket("lua_arena", CHUNK_SIZE, 0, socket_id);
+
+        if ( !chunk ) {
+            reserved -= CHUNK_SIZE;
+
+            ++failed_allocations;
+
+            return nullptr;
+        }
+
+        chunks.push_back(chunk);
+
+        chunk_pos = static_cast< uint8_t* >(chunk);
+        chunk_end = chunk_pos + CHUNK_SIZE;
+    }
+
+    void* block = chunk_pos;
+
+    chunk_pos += class_size;
+
+    return block;
+}
+
+void* dpdk_lua_arena::allocate(size_t size, bool ignore_limit) {
+    if ( size > MAX_CLASS_SIZE ) {
+        if ( !reserve(size, ignore_limit) ) {
+            return nullptr;
+        }
+
+        void* block = rte_malloc_socket("lua_arena", size, 0, socket_id);
+
+        if ( unlikely(!block) ) {
+            reserved -= size;
+
+            ++failed_allocations;
+
+            return nullptr;
+        }
+
+        used += size;
+
+        return block;
+    }
+
+    size_t size_class = get_size_class(size);
+
+    void* block = free_lists[size_class];
+
+    if ( likely(block != nullptr) ) {
+        free_lists[size_class] = free_lists[size_class]->next;
+    } else {
+        block = refill(size_class, ignore_limit);
+
+        if ( !block ) {
+            return nullptr;
+        }
+    }
+
+    used += get_class_size(size_class);
+
+    return block;
+}
+
+void dpdk_lua_arena::deallocate(void* ptr, size_t size) {
+    if ( unlikely(!kept_blocks.empty()) ) {
+        auto kept_block = kept_blocks.find(ptr);
+
+        if ( kept_block != kept_blocks.end() ) {
+            size = kept_block->second;
+
+            kept_blocks.erase(kept_block);
+        }
+    }
+
+    if ( size > MAX_CLASS_SIZE ) {
+        rte_free(ptr);
+
+        used -= size;
+        reserved -= size;
+
+        return;
+    }
+
+    size_t size_class = get_size_class(size);
+
+    auto* block = static_cast< free_block* >(ptr);
+
+    block->next            = free_lists[size_class];
+    free_lists[size_class] = block;
+
+    used -= get_class_size(size_class);
+}
+
+void* dpdk_lua_arena::reallocate(void* ptr, size_t old_size, size_t new_size) {
+    // Still fits into the same block
+    if ( old_size <= MAX_CLASS_SIZE && new_size <= MAX_CLASS_SIZE &&
+         get_size_class(old_size) == get_size_class(new_size) ) {
+        return ptr;
+    }
+
+    bool shrink = (new_size <= old_size);
+
+    void* new_ptr = allocate(new_size, shrink);
+
+    if ( !new_ptr ) {
+        if ( !shrink ) {
+            return nullptr;
+        }
+
+        // Only if DPDK itself is out of memory. Lua relies on shrinking to never fail, so keep the larger block
+        if ( old_size > MAX_CLASS_SIZE || kept_blocks.count(ptr) ) {
+            // Lua only knows the new size from now on. Remember the real one so the block goes back to DPDK in full.
+            // Doesn't overwrite the size of a block that has been kept before
+            kept_blocks.emplace(ptr, old_size);
+        } else {
+            // A chunk block ends up on the free list of the new size, which wastes the rest of it but is safe
+            used -= get_class_size(get_size_class(old_size));
+            used += get_class_size(get_size_class(new_size));
+        }
+
+        return ptr;
+    }
+
+    std::memcpy(new_ptr, ptr, std::min(old_size, new_size));
+
+    deallocate(ptr, old_size);
+
+    return new_ptr;
+}
@@ -0,0 +1,169 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#include <drop_stats.hpp>
+
+#include <common/network_utils.hpp>
+
+#include <rte_cycles.h>
+#include <rte_errno.h>
+#include <rte_memcpy.h>
+
+#include <algorithm>
+
+#if TELEMETRY_ENABLED == 1
+#include <flow_telemetry.hpp>
+#endif
+
+
+drop_stats packet_drop_stats;
+
+
+const char* get_drop_reason_name(drop_reason reason) {
+    switch ( reason ) {
+        case drop_reason::INVALID_PACKET:
+            return "invalid_packet";
+        case drop_reason::PROCESSOR:
+            return "processor";
+        case drop_reason::VERDICT:
+            return "verdict";
+        case drop_reason::NO_ROUTE:
+            return "no_route";
+        case drop_reason::RING_FULL:
+            return "ring_full";
+        case drop_reason::COPY_FAILED:
+            return "copy_failed";
+        case drop_reason::TX_FAILED:
+            return "tx_failed";
+        default:
+            return "unknown";
+    }
+}
+
+
+#if TELEMETRY_ENABLED == 1
+/**
+ * @brief Exports the summed up counters as <name>::<reason>.
+ */
+class drop_stats_metric : public metric_base
+{
+public:
+    drop_stats_metric(std::string name, const drop_stats& stats) :
+        metric_base(std::move(name), metric_unit::PACKETS), stats(stats) {}
+
+private:
+    void serialize(json& v, const std::string& prefix) override {
+        for ( size_t idx = 0; idx < NUM_DROP_REASONS; ++idx ) {
+            auto reason = (drop_reason) idx;
+
+            json value_obj;
+
+            metric_serializer< uint64_t >::convert(value_obj, stats.get_total(reason));
+
+            v.push_back({{"label", fmt::format("{}::{}", prefix, get_drop_reason_name(reason))},
+                         {"value", std::move(value_obj)},
+                         {"unit", metric_base::get_unit_str(get_unit())}});
+        }
+    }
+
+    const drop_stats& stats;
+};
+#endif
+
+
+drop_stats::drop_stats() : sample_interval(0) {
+    for ( auto& data : per_lcore_data ) {
+        data.counters.fill(0);
+
+        data.drops_since_sample = 0;
+    }
+}
+
+drop_stats::~drop_stats() {}
+
+uint64_t drop_stats::get_total(drop_reason reason) const noexcept {
+    uint64_t total = 0;
+
+    for ( const auto& data : per_lcore_data ) {
+        total += data.counters[(size_t) reason];
+    }
+
+    return total;
+}
+
+void drop_stats::enable_sampling(uint32_t interval, uint32_t ring_size) {
+    if ( !interval ) {
+        return;
+    }
+
+    sample_ring = std::unique_ptr< rte_ring, dpdk_ring_deleter >(
+        rte_ring_create_elem("drop_samples", sizeof(drop_sample), ring_size, SOCKET_ID_ANY, RING_F_SC_DEQ));
+
+    if ( !sample_ring ) {
+        throw std::runtime_error(fmt::format("could not create drop sample ring: {}", rte_strerror(rte_errno)));
+    }
+
+    sample_interval = interval;
+
+    log(LOG_INFO, "Sampling every {}th dropped packet per lcore", interval);
+}
+
+void drop_stats::disable_sampling() {
+    sample_interval = 0;
+
+    sample_ring.reset();
+}
+
+size_t drop_stats::read_samples(drop_sample* samples, size_t max_samples) {
+    if ( !sample_ring ) {
+        return 0;
+    }
+
+    return rte_ring_sc_dequeue_burst_elem(sample_ring.get(), samples, sizeof(drop_sample), max_samples, nullptr);
+}
+
+void drop_stats::sample(lcore_data& data, drop_reason reason, rte_mbuf* const* mbufs, uint16_t num) noexcept {
+    for ( uint16_t idx = 0; idx < num; ++idx ) {
+        if ( ++data.drops_since_sample < sample_interval ) {
+            continue;
+        }
+
+        data.drops_since_sample = 0;
+
+        const rte_mbuf* mbuf = mbufs[idx];
+
+        const auto* packet_info = reinterpret_cast< const packet_private_info* >(rte_mbuf_to_priv((rte_mbuf*) mbuf));
+
+        drop_sample s;
+
+        s.timestamp       = rte_get_tsc_cycles();
+        s.pkt_len         = mbuf->pkt_len;
+        s.lcore_id        = rte_lcore_id();
+        s.src_endpoint_id = packet_info->src_endpoint_id;
+        s.dst_endpoint_id = packet_info->dst_endpoint_id;
+        s.reason          = reason;
+        s.header_len      = (uint16_t) std::min< uint32_t >(mbuf->pkt_len, DROP_SAMPLE_HEADER_SIZE);
+
+        const void* header = rte_pktmbuf_read(mbuf, 0, s.header_len, s.header);
+
+        if ( header && header != s.header ) {
+            rte_memcpy(s.header, header, s.header_len);
+        }
+
+        // Losing samples is fine if nobody drains the ring
+        rte_ring_mp_enqueue_elem(sample_ring.get(), &s, sizeof(drop_sample));
+    }
+}
+
+#if TELEMETRY_ENABLED == 1
+void drop_stats::init_telemetry(telemetry_distributor& telemetry) {
+    if ( !metric ) {
+        metric = std::make_unique< drop_stats_metric >("drops", *this);
+    }
+
+    telemetry.add_metric(*metric);
+}
+#endif
@@ -6,6 +6,7 @@
 
 #include <flow_base.hpp>
 #include <rte_compat.h>
+#include <rte_errno.h>
 #include <rte_malloc.h>
 
 const std::string flow_dir_label< flow_dir::RX >::name = "rx";
@@ -40,6 +41,9 @@ std::string get_flow_dir_name(flow_dir dir) {
 
 static constexpr uint16_t FLOW_TABLE_KEYING_FACTOR = 8;
 
+// Real flow hashes only occupy the lower 32 bits, so this value never matches a valid hash
+static constexpr flow_hash FLOW_HASH_INVALID = std::numeric_limits< flow_hash >::max();
+
 struct alignas(RTE_CACHE_LINE_SIZE) flow_table_entry_state
 {
 
@@ -50,10 +54,49 @@ struct alignas(RTE_CACHE_LINE_SIZE) flow_table_entry_state
     uint16_t lru_head;
 };
 
+struct alignas(RTE_CACHE_LINE_SIZE) flow_lcore_cache
+{
+    struct entry
+    {
+        flow_hash hash;
+
+        flow_info_ipv4* flow_info;
+    };
+
+    entry entries[flow_database::LCORE_CACHE_SIZE];
+
+    struct retired_entry
+    {
+        flow_info_ipv4* flow_info;
+
+        // Grace period that has to be over before the entry may be reused
+        uint64_t token;
+    };
+
+    // Entries this lcore unlinked from the table, oldest first. Tokens only grow, so they are reclaimed in order
+    retired_entry retired[flow_database::MAX_RETIRED_ENTRIES];
+
+    uint32_t retired_head;
+    uint32_t num_retired;
+
+    __inline void flush() noexcept {
+        for ( auto& e : entries ) {
+            e.hash      = FLOW_HASH_INVALID;
+            e.flow_info = nullptr;
+        }
+    }
+};
+
+static_assert((sizeof(flow_expire_event) % 4) == 0, "ring elements must be a multiple of 4 bytes");
+
+static_assert((flow_database::LCORE_CACHE_SIZE & (flow_database::LCORE_CACHE_SIZE - 1)) == 0,
+              "LCORE_CACHE_SIZE must be a power of two");
+
 flow_database::flow_database(size_t max_entries, std::vector< lcore_info > write_allowed_lcores) :
     max_entries(max_entries), current_num_entries(0), write_allowed_lcores(write_allowed_lcores) {
 
-    size_t element_size = sizeof(flow_info_ipv4);
+    // Each element holds the flow info followed by its flow local storage
+    size_t element_size = sizeof(flow_info_ipv4) + FLOW_LOCAL_STORAGE_SIZE;
     size_t cache_size   = 0;
 
     mempool = std::unique_ptr< rte_mempool, mempool_deleter >(rte_mempool_create("flowdatabase_pool",
@@ -82,8 +125,15 @@ flow_database::flow_database(size_t max_entries, std::vector< lcore_info > write
     rcu_state = std::unique_ptr< rte_rcu_qsbr, dpdk_malloc_deleter >(
         (rte_rcu_qsbr*) rte_zmalloc(nullptr, rcu_state_size, RTE_CACHE_LINE_SIZE));
 
+    sync_rcu_state = std::unique_ptr< rte_rcu_qsbr, dpdk_malloc_deleter >(
+        (rte_rcu_qsbr*) rte_zmalloc(nullptr, rcu_state_size, RTE_CACHE_LINE_SIZE));
 
-    if ( rte_rcu_qsbr_init(rcu_state.get(), lcore_max.get_lcore_id() + 1) ) {
+    if ( !rcu_state || !sync_rcu_state ) {
+        throw std::runtime_error("could not allocate rcu state");
+    }
+
+    if ( rte_rcu_qsbr_init(rcu_state.get(), lcore_max.get_lcore_id() + 1) ||
+         rte_rcu_qsbr_init(sync_rcu_state.get(), lcore_max.get_lcore_id() + 1) ) {
         throw std::runtime_error("could not init rcu state");
     }
 
@@ -97,6 +147,20 @@ flow_database::flow_database(size_t max_entries, std::vector< lcore_info > write
     }
 
     std::memset(table_memory->addr, 0, flow_table_memsize);
+
+    // Each lcore that may touch the table gets its own cache on its own NUMA node
+    for ( const auto& lc : write_allowed_lcores ) {
+        auto* cache = (flow_lcore_cache*) rte_zmalloc_socket(
+            nullptr, sizeof(flow_lcore_cache), RTE_CACHE_LINE_SIZE, lc.get_socket_id());
+
+        if ( !cache ) {
+            throw std::runtime_error(fmt::format("could not allocate flow cache for lcore {}", lc.get_lcore_id()));
+        }
+
+        cache->flush();
+
+        lcore_caches[lc.get_lcore_id()] = std::unique_ptr< flow_lcore_cache, dpdk_malloc_deleter >(cache);
+    }
 }
 
 flow_database::~flow_database() {}
@@ -109,18 +173,41 @@ flow_info_ipv4* flow_database::get_or_create(flow_hash fhash, bool& created) {
 
     unsigned int lcore_id = rte_lcore_id();
 
+    flow_info_ipv4* flow_entry = nullptr;
+
+    flow_lcore_cache::entry* cache_entry = nullptr;
+
+    if ( likely(lcore_id < RTE_MAX_LCORE) ) {
+        flow_lcore_cache* cache = lcore_caches[lcore_id].get();
+
+        if ( likely(cache != nullptr) ) {
+            cache_entry = &cache->entries[fhash & (LCORE_CACHE_SIZE - 1)];
+
+            if ( likely(cache_entry->hash == fhash) ) {
+                flow_entry = cache_entry->flow_info;
+
+                // The entry may have been recycled since it got cached, in an earlier burst. Recycled entries carry
+                // FLOW_HASH_INVALID or the hash of their new flow. Within this burst it can't be recycled anymore, that
+                // needs this lcore to pass flow_purge_checkpoint first
+                if ( likely(flow_entry->flow_hash == fhash) ) {
+                    flow_entry->last_used = rte_get_tsc_cycles();
+
+                    return flow_entry;
+                }
+
+                flow_entry = nullptr;
+            }
+        }
+    }
+
     rte_rcu_qsbr* rcu = rcu_state.get();
 
     flow_table_entry_state* flow_table_data = (flow_table_entry_state*) table_memory.get()->addr;
 
-    flow_info_ipv4* flow_entry = nullptr;
-
     // Dummy key reduction
     uint32_t reduced_key = (fhash % max_entries);
 
     {
-        uint16_t target_index;
-
         flow_table_entry_state* dst_state = flow_table_data + reduced_key;
 
         rte_rcu_qsbr_lock(rcu, lcore_id);
@@ -129,8 +216,7 @@ flow_info_ipv4* flow_database::get_or_create(flow_hash fhash, bool& created) {
 
         do {
             if ( dst_state->hash[index] == fhash ) {
-                flow_entry   = dst_state->flow_info[index];
-                target_index = index;
+                flow_entry = dst_state->flow_info[index];
                 break;
             }
 
@@ -144,17 +230,23 @@ flow_info_ipv4* flow_database::get_or_create(flow_hash fhash, bool& created) {
 
         rte_rcu_qsbr_unlock(rcu, lcore_id);
 
-        if ( !flow_entry ) {
-            struct flow_info_ipv4* oldest_entry = nullptr;
+        // Replacing an entry needs room to retire it. Lcores without a cache can't, they only fill empty slots
+        bool can_evict = !flow_entry && cache_entry &&
+                         (lcore_caches[lcore_id]->num_retired < MAX_RETIRED_ENTRIES ||
+                          reclaim_entries(*lcore_caches[lcore_id]) > 0);
 
-            auto qs_token = rte_rcu_qsbr_start(rcu);
+        uint16_t next_lru_head = (dst_state->lru_head > 0) ? dst_state->lru_head - 1 : FLOW_TABLE_KEYING_FACTOR - 1;
 
-            rte_rcu_qsbr_quiescent(rcu, lcore_id);
+        if ( !flow_entry && (can_evict || !dst_state->flow_info[next_lru_head]) ) {
+            struct flow_info_ipv4* oldest_entry = nullptr;
 
             rte_mempool_get(mempool.get(), (void**) &flow_entry);
 
             if ( likely(flow_entry != nullptr) ) {
 
+                // Set before the entry gets visible, lcore caches validate against it
+                flow_entry->flow_hash = fhash;
+
                 uint16_t old_lru_head = dst_state->lru_head;
 
                 uint16_t new_lru_head;
@@ -170,48 +262,198 @@ flow_info_ipv4* flow_database::get_or_create(flow_hash fhash, bool& created) {
                 rte_compiler_barrier();
                 dst_state->flow_info[new_lru_head] = flow_entry;
 
-                rte_rcu_qsbr_check(rcu, qs_token, true);
+                dst_state->lru_head = new_lru_head;
 
-                rte_mempool_put(mempool.get(), (void*) oldest_entry);
+                if ( oldest_entry ) {
+                    // Other lcores may still use it in their current burst. Returned to the pool by
+                    // flow_purge_checkpoint once all of them finished that burst
+                    flow_lcore_cache& cache = *lcore_caches[lcore_id];
 
-                dst_state->lru_head = new_lru_head;
+                    auto& retired = cache.retired[(cache.retired_head + cache.num_retired) % MAX_RETIRED_ENTRIES];
 
-                created = true;
+                    retired.flow_info = oldest_entry;
+                    retired.token     = rte_rcu_qsbr_start(rcu);
+
+                    ++cache.num_retired;
+                } else {
+                    ++current_num_entries;
+                }
 
-                ++current_num_entries;
+                created = true;
             }
-        } else {
-            rte_rcu_qsbr_quiescent(rcu, lcore_id);
         }
     }
 
     if ( flow_entry ) {
         flow_entry->last_used = rte_get_tsc_cycles();
+
+        if ( cache_entry ) {
+            cache_entry->hash      = fhash;
+            cache_entry->flow_info = flow_entry;
+        }
     }
 
     return flow_entry;
 }
 
 void flow_database::flow_purge_checkpoint(unsigned int lcore_id) {
+    // Every flow_info this lcore got during the burst is out of use now
     rte_rcu_qsbr_quiescent(rcu_state.get(), lcore_id);
+
+    // Still before the quiescent state on sync_rcu_state, the expire subscriptions can't go away meanwhile
+    if ( flow_lcore_cache* cache = lcore_caches[lcore_id].get(); cache && cache->num_retired ) {
+        reclaim_entries(*cache);
+    }
+
+    rte_rcu_qsbr_quiescent(sync_rcu_state.get(), lcore_id);
+}
+
+uint32_t flow_database::reclaim_entries(flow_lcore_cache& cache) {
+    uint32_t num_reclaimed = 0;
+
+    while ( cache.num_retired ) {
+        auto& retired = cache.retired[cache.retired_head];
+
+        if ( rte_rcu_qsbr_check(rcu_state.get(), retired.token, false) != 1 ) {
+            break;
+        }
+
+        expire_entry(retired.flow_info);
+
+        cache.retired_head = (cache.retired_head + 1) % MAX_RETIRED_ENTRIES;
+
+        --cache.num_retired;
+        ++num_reclaimed;
+    }
+
+    return num_reclaimed;
+}
+
+void flow_database::expire_entry(flow_info_ipv4* entry) {
+    const auto* subscriptions = active_expire_subscriptions.load(std::memory_order_acquire);
+
+    // Nobody can touch the entry anymore, so the snapshot is consistent
+    if ( unlikely(subscriptions != nullptr) ) {
+        flow_expire_event event;
+
+        event.info = *entry;
+
+        std::memcpy(event.storage, get_flow_local_storage(entry), FLOW_LOCAL_STORAGE_SIZE);
+
+        for ( expire_subscription* subscription : *subscriptions ) {
+            if ( rte_ring_mp_enqueue_elem(subscription->ring.get(), &event, sizeof(flow_expire_event)) != 0 ) {
+                subscription->num_lost.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Lcore caches that still point to it see the mismatch and fall back to the table
+    entry->flow_hash = FLOW_HASH_INVALID;
+
+    rte_mempool_put(mempool.get(), (void*) entry);
 }
 
 void flow_database::set_lcore_active(unsigned int lcore_id) {
     rte_rcu_qsbr_thread_register(rcu_state.get(), lcore_id);
+    rte_rcu_qsbr_thread_register(sync_rcu_state.get(), lcore_id);
 
     lcore_state[lcore_id] = 1;
 
     rte_rcu_qsbr_thread_online(rcu_state.get(), lcore_id);
+    rte_rcu_qsbr_thread_online(sync_rcu_state.get(), lcore_id);
 }
 
 void flow_database::set_lcore_inactive(unsigned int lcore_id) {
+    // Nothing this lcore retired may stay behind. Waits for the others to finish their current burst
+    if ( flow_lcore_cache* cache = lcore_caches[lcore_id].get(); cache && cache->num_retired ) {
+        rte_rcu_qsbr_synchronize(rcu_state.get(), lcore_id);
+
+        reclaim_entries(*cache);
+    }
+
+    rte_rcu_qsbr_thread_offline(sync_rcu_state.get(), lcore_id);
     rte_rcu_qsbr_thread_offline(rcu_state.get(), lcore_id);
 
     lcore_state[lcore_id] = 0;
 
+    rte_rcu_qsbr_thread_unregister(sync_rcu_state.get(), lcore_id);
     rte_rcu_qsbr_thread_unregister(rcu_state.get(), lcore_id);
 }
 
+void flow_database::rcu_synchronize() {
+    rte_rcu_qsbr_synchronize(sync_rcu_state.get(), RTE_QSBR_THRID_INVALID);
+}
+
+rte_ring* flow_database::subscribe_expired_flows(size_t capacity) {
+    std::string ring_name = fmt::format("flow_expire_{}", next_expire_ring_id++);
+
+    rte_ring* ring = rte_ring_create_elem(ring_name.c_str(),
+                                          sizeof(flow_expire_event),
+                                          rte_align32pow2(capacity),
+                                          SOCKET_ID_ANY,
+                                          RING_F_SC_DEQ);
+
+    if ( !ring ) {
+        throw std::runtime_error(fmt::format("could not create flow expire ring: {}", rte_strerror(rte_errno)));
+    }
+
+    auto subscription = std::make_unique< expire_subscription >();
+
+    subscription->ring.reset(ring);
+
+    expire_subscriptions.push_back(std::move(subscription));
+
+    publish_expire_subscriptions();
+
+    return ring;
+}
+
+void flow_database::unsubscribe_expired_flows(rte_ring* ring) {
+    auto it = std::find_if(expire_subscriptions.begin(), expire_subscriptions.end(), [ring](const auto& subscription) {
+        return subscription->ring.get() == ring;
+    });
+
+    if ( it == expire_subscriptions.end() ) {
+        return;
+    }
+
+    // Destroys the ring once the datapath doesn't see it anymore
+    std::unique_ptr< expire_subscription > subscription = std::move(*it);
+
+    expire_subscriptions.erase(it);
+
+    publish_expire_subscriptions();
+}
+
+void flow_database::publish_expire_subscriptions() {
+    std::unique_ptr< std::vector< expire_subscription* > > new_list;
+
+    if ( !expire_subscriptions.empty() ) {
+        new_list = std::make_unique< std::vector< expire_subscription* > >();
+
+        for ( auto& subscription : expire_subscriptions ) {
+            new_list->push_back(subscription.get());
+        }
+    }
+
+    active_expire_subscriptions.store(new_list.get(), std::memory_order_release);
+
+    // Returns right away if no lcore is active
+    rcu_synchronize();
+
+    expire_subscription_list = std::move(new_list);
+}
+
+uint64_t flow_database::get_num_lost_expire_events(const rte_ring* ring) const {
+    for ( const auto& subscription : expire_subscriptions ) {
+        if ( subscription->ring.get() == ring ) {
+            return subscription->num_lost.load(std::memory_order_relaxed);
+        }
+    }
+
+    return 0;
+}
+
 size_t flow_database::get_num_flows() {
    return current_num_entries.load(std::memory_order_relaxed); 
 }
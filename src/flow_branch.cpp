@@ -0,0 +1,152 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#include <flow_branch.hpp>
+
+#include <common/network_utils.hpp>
+
+#include <algorithm>
+
+
+flow_branch::flow_branch(std::string                            name,
+                         std::shared_ptr< dpdk_packet_mempool > mempool,
+                         std::shared_ptr< flow_database >       flow_database_ptr) :
+    flow_processor(std::move(name), std::move(mempool)),
+    flow_database_ptr(std::move(flow_database_ptr)),
+    branch_type(flow_branch_type::PROTO) {}
+
+__inline uint8_t flow_branch::select_output(rte_mbuf* mbuf) const noexcept {
+    const auto* packet_info = get_private_packet_info(mbuf);
+
+    if ( branch_type == flow_branch_type::NEW_FLOW ) {
+        return packet_info->new_flow ? 0 : 1;
+    }
+
+    if ( packet_info->ether_type != ether_type_info< RTE_ETHER_TYPE_IPV4 >::ether_type_be ) {
+        return 3;
+    }
+
+    switch ( packet_info->ipv4_type ) {
+        case IP_PROTO_TCP:
+            return 0;
+        case IP_PROTO_UDP:
+            return 1;
+        case IP_PROTO_ICMP:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+uint16_t flow_branch::process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) {
+    std::array< static_mbuf_vec< MAX_BURST_SIZE >, MAX_OUTPUTS > sub_bursts;
+
+    for ( auto packet : mbuf_vec ) {
+        mbuf_vec_base& sub_burst = sub_bursts[select_output(packet)];
+
+        sub_burst.end()[0] = packet;
+        sub_burst.grow_tail(1);
+    }
+
+    // The packets now belong to the sub bursts
+    mbuf_vec.consume();
+
+    for ( size_t output_idx = 0; output_idx < output_names.size(); ++output_idx ) {
+        mbuf_vec_base& sub_burst = sub_bursts[output_idx];
+
+        if ( !sub_burst.size() ) {
+            continue;
+        }
+
+        if ( output_flows[output_idx] ) {
+            output_flows[output_idx]->process(sub_burst, ctx);
+        }
+
+        std::copy(sub_burst.begin(), sub_burst.end(), mbuf_vec.end());
+
+        mbuf_vec.grow_tail(sub_burst.size());
+
+        sub_burst.consume();
+    }
+
+    // Built for the whole burst, which no longer exists in this order
+    ctx.get_flow_groups().invalidate();
+
+    return mbuf_vec.size();
+}
+
+void flow_branch::init(const flow_proc_builder& builder) {
+    std::string branch_by = builder.get_param("branch_by").value_or("proto");
+
+    if ( branch_by == "proto" ) {
+        branch_type  = flow_branch_type::PROTO;
+        output_names = {"tcp", "udp", "icmp", "other"};
+    } else if ( branch_by == "new_flow" ) {
+        branch_type  = flow_branch_type::NEW_FLOW;
+        output_names = {"new", "known"};
+    } else {
+        throw std::runtime_error(fmt::format("flow branch {}: unknown branch_by '{}'", get_name(), branch_by));
+    }
+
+    for ( const auto& [output_name, first_proc] : builder.get_outputs() ) {
+        auto name_it = std::find(output_names.begin(), output_names.end(), output_name);
+
+        if ( name_it == output_names.end() ) {
+            throw std::runtime_error(fmt::format(
+                "flow branch {}: no output '{}' when branching by {}", get_name(), output_name, branch_by));
+        }
+
+        auto output_flow = std::make_unique< packet_proc_flow >(fmt::format("{}::{}", get_name(), output_name));
+
+        std::string chain_str;
+
+        for ( auto current = first_proc; current; current = current->get_next_proc() ) {
+            chain_str = chain_str.empty() ? current->get_instance_name()
+                                          : fmt::format("{} -> {}", chain_str, current->get_instance_name());
+
+            output_flow->add_proc(create_flow_processor(current, get_mempool_shared(), flow_database_ptr));
+        }
+
+        output_flow->fuse();
+
+        log(LOG_INFO, "flow branch {} output {}: {}", get_name(), output_name, chain_str);
+
+        output_flows[name_it - output_names.begin()] = std::move(output_flow);
+    }
+}
+
+bool flow_branch::writes_packets() const noexcept {
+    // Splitting and merging only moves pointers around
+    return std::any_of(output_flows.begin(), output_flows.end(), [](const auto& output_flow) {
+        return output_flow && output_flow->writes_packets();
+    });
+}
+
+void flow_branch::lcore_init(uint32_t lcore_id) {
+    for ( auto& output_flow : output_flows ) {
+        if ( output_flow ) {
+            output_flow->lcore_init(lcore_id);
+        }
+    }
+}
+
+void flow_branch::control_poll() {
+    for ( auto& output_flow : output_flows ) {
+        if ( output_flow ) {
+            output_flow->control_poll();
+        }
+    }
+}
+
+#if TELEMETRY_ENABLED == 1
+void flow_branch::init_telemetry(telemetry_distributor& telemetry) {
+    for ( auto& output_flow : output_flows ) {
+        if ( output_flow ) {
+            output_flow->init_telemetry(telemetry);
+        }
+    }
+}
+#endif
@@ -25,6 +25,13 @@ std::shared_ptr< flow_proc_builder > flow_proc_builder::next(std::shared_ptr< fl
     return next_proc;
 }
 
+std::shared_ptr< flow_proc_builder > flow_proc_builder::output(const std::string&                   output_name,
+                                                               std::shared_ptr< flow_proc_builder > p) {
+    outputs[output_name] = p;
+
+    return p;
+}
+
 
 std::shared_ptr< flow_proc_builder > flow_endpoint_builder::add_rx_proc(std::shared_ptr< flow_proc_builder > p) {
     if ( !first_rx_proc ) {
@@ -56,4 +63,16 @@ std::shared_ptr< flow_proc_builder > flow_endpoint_builder::add_tx_proc(std::sha
 
         return current->next(std::move(p));
     }
-}
\ No newline at end of file
+}
+
+void flow_endpoint_builder::set_burst_size(uint16_t max_size, uint16_t min_size) {
+    if ( max_size == 0 || max_size > MAX_BURST_SIZE || min_size == 0 || min_size > max_size ) {
+        throw std::runtime_error(fmt::format("invalid burst size {}..{} for endpoint {}, must be within 1..{}",
+                                             min_size,
+                                             max_size,
+                                             get_instance_name(),
+                                             MAX_BURST_SIZE));
+    }
+
+    burst_limits = burst_size_limits {min_size, max_size};
+}
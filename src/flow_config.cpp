@@ -19,6 +19,12 @@ public:
         ut_proc.unregister();
     }
 
+    // The endpoints passed to init(), their index is the endpoint id
+    std::vector< std::shared_ptr< flow_endpoint_builder > > endpoints;
+
+    // Filled by flow.multicast_group()
+    std::map< uint16_t, std::vector< uint16_t > > multicast_groups;
+
 private:
     void init() override {
 
@@ -30,6 +36,10 @@ private:
         ut_endpoint["add_rx_proc"]                 = &flow_endpoint_builder::add_rx_proc;
         ut_endpoint["add_tx_proc"]                 = &flow_endpoint_builder::add_tx_proc;
         ut_endpoint["port_num"]                    = &flow_endpoint_builder::get_port_num;
+        ut_endpoint["set_burst_size"] =
+            [](flow_endpoint_builder& ep, uint16_t max_size, sol::optional< uint16_t > min_size) {
+                ep.set_burst_size(max_size, min_size.value_or(max_size));
+            };
 
         ut_proc = new_usertype< flow_proc_builder >(
             "processor", sol::no_constructor, sol::base_classes, sol::bases< flow_builder_node >());
@@ -37,6 +47,7 @@ private:
         ut_proc["get_instance_name"]           = &flow_builder_node::get_instance_name;
         ut_proc[sol::meta_function::to_string] = &flow_builder_node::get_instance_name;
         ut_proc["next"]                        = &flow_proc_builder::next;
+        ut_proc["output"]                      = &flow_proc_builder::output;
         ut_proc["set_param"]                   = &flow_proc_builder::set_param;
         ut_proc["get_param"]                   = &flow_proc_builder::get_param;
 
@@ -48,6 +59,38 @@ private:
 
                     return std::make_shared< flow_proc_builder >(instance_name, class_name);
                 }));
+
+        // Members are endpoints or endpoint ids
+        set_function< void >(
+            "multicast_group",
+            std::function< void(uint16_t, sol::table) >([this](uint16_t group_id, sol::table members) {
+                if ( group_id >= MAX_MULTICAST_GROUPS ) {
+                    throw std::runtime_error(
+                        fmt::format("multicast group {} out of range (max {})", group_id, MAX_MULTICAST_GROUPS - 1));
+                }
+
+                std::vector< uint16_t > member_ids;
+
+                for ( const auto& [key, value] : members ) {
+                    if ( value.is< flow_endpoint_builder >() ) {
+                        member_ids.push_back(get_endpoint_id(value.as< flow_endpoint_builder& >()));
+                    } else {
+                        member_ids.push_back(value.as< uint16_t >());
+                    }
+                }
+
+                multicast_groups[group_id] = std::move(member_ids);
+            }));
+    }
+
+    uint16_t get_endpoint_id(const flow_endpoint_builder& endpoint) const {
+        for ( size_t idx = 0; idx < endpoints.size(); ++idx ) {
+            if ( endpoints[idx].get() == &endpoint ) {
+                return (uint16_t) idx;
+            }
+        }
+
+        throw std::runtime_error(fmt::format("unknown endpoint {}", endpoint.get_instance_name()));
     }
 
     init_script_handler& init_handler;
@@ -83,6 +126,27 @@ flow_program init_script_handler::build_program(
     std::vector< std::unique_ptr< flow_endpoint_base > > available_endpoints,
     const std::shared_ptr< flow_database >&              flow_database) {
 
+    std::vector< flow_endpoint_base* > endpoint_ptrs;
+
+    std::transform(available_endpoints.begin(),
+                   available_endpoints.end(),
+                   std::back_inserter(endpoint_ptrs),
+                   [](auto& ep) { return ep.get(); });
+
+    flow_program prog = build_program(endpoint_ptrs, flow_database);
+
+    size_t endpoint_idx = 0;
+
+    for ( auto& flow : prog ) {
+        flow.set_endpoint(std::move(available_endpoints[endpoint_idx++]));
+    }
+
+    return prog;
+}
+
+flow_program init_script_handler::build_program(const std::vector< flow_endpoint_base* >& available_endpoints,
+                                                const std::shared_ptr< flow_database >&   flow_database) {
+
     std::string current_context_name;
 
     try {
@@ -99,12 +163,18 @@ flow_program init_script_handler::build_program(
                 return std::make_shared< flow_endpoint_builder >(ep->get_name(), ep->get_port_num());
             });
 
+        flow_ext.endpoints = endpoint_list;
+
         current_context_name = "calling init()";
 
         lua.call< void >("init", endpoint_list);
 
         flow_program prog(program_name, flow_database);
 
+        for ( auto& [group_id, members] : flow_ext.multicast_groups ) {
+            prog.set_multicast_group(group_id, std::move(members));
+        }
+
         for ( size_t endpoint_idx = 0; endpoint_idx < available_endpoints.size(); ++endpoint_idx ) {
             const auto& ep = endpoint_list[endpoint_idx];
 
@@ -115,6 +185,8 @@ flow_program init_script_handler::build_program(
 
             auto& flow = prog.add_flow(fmt::format("flow-{}", ep->get_port_num()));
 
+            flow.set_burst_limits(ep->get_burst_limits());
+
             if ( current ) {
 
                 std::string s;
@@ -131,8 +203,6 @@ flow_program init_script_handler::build_program(
             } else {
                 log(LOG_INFO, "Flow for endpoint {} is empty", ep->get_instance_name());
             }
-
-            flow.set_endpoint(std::move(available_endpoints[endpoint_idx]));
         }
 
         return prog;
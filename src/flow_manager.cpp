@@ -8,13 +8,16 @@
 
 #include <flow_executor.hpp>
 
+#include <rte_memcpy.h>
+
+#include <numeric>
 #include <optional>
 
 
-flow_distributor::flow_distributor(size_t max_ports, size_t num_queues, uint32_t ring_size) :
-    max_ports(max_ports), num_queues(num_queues), num_active_ports(0), ring_size(ring_size) {
+flow_distributor::flow_distributor(size_t num_ports, size_t num_queues, uint32_t ring_size) :
+    num_ports(num_ports), num_queues(num_queues), ring_size(ring_size) {
 
-    size_t total_num_rings = max_ports * num_queues;
+    size_t total_num_rings = num_ports * num_queues;
 
     rings.reserve(total_num_rings);
 
@@ -22,11 +25,117 @@ flow_distributor::flow_distributor(size_t max_ports, size_t num_queues, uint32_t
         // TODO: Enable passing of socket id
         rings.emplace_back(fmt::format("fd-ring-{}", index), 0, ring_size);
     }
+
+    all_ports.resize(num_ports);
+
+    std::iota(all_ports.begin(), all_ports.end(), 0);
 }
 
 flow_distributor::~flow_distributor() {}
 
+std::unique_ptr< const multicast_group_table > flow_distributor::set_multicast_groups(
+    std::unique_ptr< const multicast_group_table > new_groups) {
+
+    std::swap(groups, new_groups);
+
+    active_groups.store(groups.get(), std::memory_order_release);
+
+    return new_groups;
+}
+
+void flow_distributor::fan_out(rte_mbuf*       mbuf,
+                               uint16_t        src_port_id,
+                               uint16_t        queue_id,
+                               const uint16_t* dst_ports,
+                               size_t          num_dst_ports) {
+    uint16_t num_refs = 0;
+
+    for ( size_t idx = 0; idx < num_dst_ports; ++idx ) {
+        if ( dst_ports[idx] != src_port_id ) {
+            ++num_refs;
+        }
+    }
+
+    if ( unlikely(!num_refs) ) {
+        packet_drop_stats.record(drop_reason::NO_ROUTE, mbuf);
+
+        rte_pktmbuf_free(mbuf);
+
+        return;
+    }
+
+    // All references have to exist before the first enqueue, the distributor may transmit and free right away. Whoever
+    // drops the last one returns the packet to its pool
+    if ( num_refs > 1 ) {
+        rte_pktmbuf_refcnt_update(mbuf, (int16_t) (num_refs - 1));
+    }
+
+    for ( size_t idx = 0; idx < num_dst_ports; ++idx ) {
+        uint16_t port_id = dst_ports[idx];
+
+        if ( port_id == src_port_id ) {
+            continue;
+        }
+
+        size_t ridx = (port_id * num_queues) + queue_id;
+
+        if ( !rings[ridx].enqueue_single(mbuf) ) {
+            packet_drop_stats.record(drop_reason::RING_FULL, mbuf);
+
+            rte_pktmbuf_free(mbuf);
+        }
+    }
+}
+
+void flow_distributor::enqueue_unicast(uint16_t queue_id, rte_mbuf** mbufs, uint16_t* dsts, uint16_t num) {
+    // One destination per round: its packets are moved to the front of the staging array and enqueued at once, the
+    // rest is compacted for the next round. Bursts rarely go to more than a few destinations
+    std::array< rte_mbuf*, MAX_BURST_SIZE > staged;
+
+    while ( num ) {
+        uint16_t dst_endpoint_id = dsts[0];
+        uint16_t num_staged      = 0;
+        uint16_t num_remaining   = 0;
+
+        for ( uint16_t idx = 0; idx < num; ++idx ) {
+            if ( dsts[idx] == dst_endpoint_id ) {
+                staged[num_staged++] = mbufs[idx];
+            } else {
+                mbufs[num_remaining] = mbufs[idx];
+                dsts[num_remaining]  = dsts[idx];
+
+                ++num_remaining;
+            }
+        }
+
+        num = num_remaining;
+
+        size_t ridx = (dst_endpoint_id * num_queues) + queue_id;
+
+        uint16_t num_enqueued = rings[ridx].enqueue_burst(staged.data(), num_staged);
+
+        if ( unlikely(num_enqueued < num_staged) ) {
+            uint16_t num_overflow = num_staged - num_enqueued;
+
+            packet_drop_stats.record(drop_reason::RING_FULL, staged.data() + num_enqueued, num_overflow);
+
+            dpdk_packet_mempool::bulk_free(staged.data() + num_enqueued, num_overflow);
+        }
+    }
+}
+
 void flow_distributor::push_packets(uint16_t src_port_id, uint16_t queue_id, mbuf_vec_base& mbuf_vec) {
+    // Unicast packets waiting to be sorted by destination
+    std::array< rte_mbuf*, MAX_BURST_SIZE > pending;
+    std::array< uint16_t, MAX_BURST_SIZE >  pending_dst;
+    uint16_t                                num_pending = 0;
+
+    // Freed all at once at the end
+    std::array< rte_mbuf*, MAX_BURST_SIZE > dropped;
+    uint16_t                                num_dropped = 0;
+
+    // Loaded once per burst, the table stays valid until this lcore passes its next flow_purge_checkpoint
+    const multicast_group_table* group_table = active_groups.load(std::memory_order_acquire);
 
     for ( uint16_t packet_index = 0; packet_index < mbuf_vec.size(); ++packet_index ) {
 
@@ -34,36 +143,52 @@ void flow_distributor::push_packets(uint16_t src_port_id, uint16_t queue_id, mbu
 
         auto* packet_info = reinterpret_cast< packet_private_info* >(rte_mbuf_to_priv(current_mbuf));
 
-        if ( packet_info->dst_endpoint_id == PORT_ID_BROADCAST) {
+        uint16_t dst_endpoint_id = packet_info->dst_endpoint_id;
 
-            for ( size_t port_id = 0; port_id < num_active_ports; ++port_id ) {
+        if ( likely(dst_endpoint_id < num_ports) ) {
+            pending[num_pending]     = current_mbuf;
+            pending_dst[num_pending] = dst_endpoint_id;
 
-                if(port_id == packet_info->src_endpoint_id)
-                    continue;
+            ++num_pending;
+        } else if ( dst_endpoint_id == PORT_ID_BROADCAST ) {
+            // Unicast packets that arrived earlier have to be in the rings first, otherwise an endpoint would see the
+            // packets of a flow out of order
+            enqueue_unicast(queue_id, pending.data(), pending_dst.data(), num_pending);
 
-                // A nice example of "how to make things slow". But it's the broadcast case and I don't really care for now.
-                struct rte_mbuf* cloned_packet = rte_pktmbuf_clone(current_mbuf, current_mbuf->pool);
+            num_pending = 0;
 
-                if (likely(cloned_packet)) {
-                    size_t ridx = (port_id * num_queues) + queue_id;
+            fan_out(current_mbuf, packet_info->src_endpoint_id, queue_id, all_ports.data(), all_ports.size());
+        } else if ( is_multicast_endpoint_id(dst_endpoint_id) ) {
+            uint16_t group_id = dst_endpoint_id - PORT_ID_MULTICAST_BASE;
 
-                    if ( !rings[ridx].enqueue_single(cloned_packet) ) {
-                        rte_pktmbuf_free(cloned_packet);
-                    }
-                }
+            // Groups that were never configured have no members and end up as no_route drops
+            const uint16_t* members     = nullptr;
+            size_t          num_members = 0;
+
+            if ( group_table && group_id < group_table->size() ) {
+                members     = (*group_table)[group_id].data();
+                num_members = (*group_table)[group_id].size();
             }
 
-            rte_pktmbuf_free(current_mbuf);
-        } else {
+            enqueue_unicast(queue_id, pending.data(), pending_dst.data(), num_pending);
 
-            size_t ridx = (packet_info->dst_endpoint_id * num_queues) + queue_id;
+            num_pending = 0;
 
-            if ( !rings[ridx].enqueue_single(current_mbuf) ) {
-                rte_pktmbuf_free(current_mbuf);
-            }
+            fan_out(current_mbuf, packet_info->src_endpoint_id, queue_id, members, num_members);
+        } else {
+            packet_drop_stats.record(
+                (dst_endpoint_id == PORT_ID_DROP) ? drop_reason::VERDICT : drop_reason::NO_ROUTE, current_mbuf);
+
+            dropped[num_dropped++] = current_mbuf;
         }
     }
 
+    enqueue_unicast(queue_id, pending.data(), pending_dst.data(), num_pending);
+
+    if ( num_dropped ) {
+        dpdk_packet_mempool::bulk_free(dropped.data(), num_dropped);
+    }
+
     mbuf_vec.consume();
 }
 
@@ -74,9 +199,159 @@ uint16_t flow_distributor::pull_packets(uint16_t port_id, uint16_t queue_id, mbu
 }
 
 
+// Everything the lcores need to touch for one endpoint. Kept on separate cache lines so lcores working on different
+// endpoints don't share any
+struct alignas(RTE_CACHE_LINE_SIZE) endpoint_context
+{
+    std::unique_ptr< flow_endpoint_base > endpoint;
+
+    // What the lcores run, loaded once per burst. Always equal to rx_flow / tx_flow outside of flow_manager::reload
+    std::atomic< packet_proc_flow* > active_rx_flow {nullptr};
+    std::atomic< packet_proc_flow* > active_tx_flow {nullptr};
+
+    std::unique_ptr< packet_proc_flow > rx_flow;
+    std::unique_ptr< packet_proc_flow > tx_flow;
+
+    // Only touched by the lcore polling the endpoint
+    std::optional< adaptive_burst_size > rx_burst_size;
+
+    // Pulled from the distributor at once. Whatever is there is sent right away, so this doesn't need to adapt
+    uint16_t tx_burst_size = 0;
+};
+
+// Broadcast and multicast packets are shared by all their destinations. TX chains that may write to a packet get private
+// copies of them. Packets that can't be copied are dropped
+static void unshare_packets(mbuf_vec_base& mbuf_vec) {
+    bool has_gaps = false;
+
+    for ( uint16_t idx = 0; idx < mbuf_vec.size(); ++idx ) {
+        rte_mbuf* mbuf = mbuf_vec.begin()[idx];
+
+        if ( likely(rte_mbuf_refcnt_read(mbuf) == 1) ) {
+            continue;
+        }
+
+        rte_mbuf* copy = rte_pktmbuf_copy(mbuf, mbuf->pool, 0, UINT32_MAX);
+
+        if ( likely(copy) ) {
+            // The private area is not part of the copy
+            rte_memcpy(rte_mbuf_to_priv(copy), rte_mbuf_to_priv(mbuf), mbuf->priv_size);
+        } else {
+            packet_drop_stats.record(drop_reason::COPY_FAILED, mbuf);
+
+            has_gaps = true;
+        }
+
+        rte_pktmbuf_free(mbuf);
+
+        mbuf_vec.begin()[idx] = copy;
+    }
+
+    if ( unlikely(has_gaps) ) {
+        mbuf_vec.repack();
+    }
+}
+
+// TX stages drop packets the same way RX stages do, either by removing them or by setting PORT_ID_DROP. Any other
+// destination is ignored this late
+static void drop_tx_verdicts(mbuf_vec_base& mbuf_vec) {
+    std::array< rte_mbuf*, MAX_BURST_SIZE > dropped;
+    uint16_t                                num_dropped = 0;
+
+    for ( uint16_t idx = 0; idx < mbuf_vec.size(); ++idx ) {
+        rte_mbuf* mbuf = mbuf_vec.begin()[idx];
+
+        if ( likely(get_private_packet_info(mbuf)->dst_endpoint_id != PORT_ID_DROP) ) {
+            continue;
+        }
+
+        packet_drop_stats.record(drop_reason::VERDICT, mbuf);
+
+        dropped[num_dropped++] = mbuf;
+
+        mbuf_vec.clear_packet(idx);
+    }
+
+    if ( unlikely(num_dropped) ) {
+        mbuf_vec_base::bulk_free(dropped.data(), num_dropped);
+
+        mbuf_vec.repack();
+    }
+}
+
+template < flow_dir DIR >
+static std::unique_ptr< packet_proc_flow > build_proc_flow(flow_config& flow, const std::string& endpoint_name) {
+    auto proc_flow =
+        std::make_unique< packet_proc_flow >(fmt::format("{}::{}", endpoint_name, flow_dir_label< DIR >::name));
+
+    for ( auto& proc : flow_proc_iterator< DIR >(flow) ) {
+        proc_flow->add_proc(std::move(proc));
+    }
+
+    proc_flow->fuse();
+
+    log(LOG_INFO, "Loaded {} processing chain for endpoint {}: ", flow_dir_label< DIR >::name, endpoint_name);
+
+    for ( const auto& name : proc_flow->get_chain_names() ) {
+        log(LOG_INFO, "proc : {}", name);
+    }
+
+    return proc_flow;
+}
+
+static std::unique_ptr< const multicast_group_table > build_multicast_groups(const flow_program& prog,
+                                                                             size_t              num_endpoints) {
+    auto groups = std::make_unique< multicast_group_table >();
+
+    for ( const auto& [group_id, members] : prog.get_multicast_groups() ) {
+        std::vector< bool > is_member(num_endpoints, false);
+
+        for ( uint16_t endpoint_id : members ) {
+            if ( endpoint_id >= num_endpoints ) {
+                throw std::runtime_error(
+                    fmt::format("multicast group {}: endpoint {} does not exist", group_id, endpoint_id));
+            }
+
+            if ( is_member[endpoint_id] ) {
+                throw std::runtime_error(
+                    fmt::format("multicast group {}: endpoint {} is listed twice", group_id, endpoint_id));
+            }
+
+            is_member[endpoint_id] = true;
+        }
+
+        if ( group_id >= groups->size() ) {
+            groups->resize(group_id + 1);
+        }
+
+        (*groups)[group_id] = members;
+
+        log(LOG_INFO,
+            "Multicast group {} (endpoint id {}) has {} members",
+            group_id,
+            PORT_ID_MULTICAST_BASE + group_id,
+            members.size());
+    }
+
+    return groups;
+}
+
+// The RX chain of an endpoint runs on the lcore of that endpoint, all TX chains run on the distributor lcores
+static void init_chain_lcores(const flow_executor_base< flow_manager >& executor,
+                              size_t                                    endpoint_index,
+                              packet_proc_flow&                         rx_flow,
+                              packet_proc_flow&                         tx_flow) {
+    rx_flow.lcore_init(executor.get_endpoint_lcores().at(endpoint_index).get_lcore_id());
+
+    for ( const auto& lc_info : executor.get_distributor_lcores() ) {
+        tx_flow.lcore_init(lc_info.get_lcore_id());
+    }
+}
+
 struct flow_manager::private_data
 {
-    explicit private_data(uint16_t num_queues) : active(false), distributor(MAX_NUM_FLOWS, num_queues, 128)
+    private_data(size_t num_endpoints, uint16_t num_queues) :
+        active(false), distributor(num_endpoints, num_queues, 128), num_endpoints(num_endpoints), endpoints(num_endpoints)
 #if TELEMETRY_ENABLED == 1
     ,flow_metric_grp("flows")
     ,m_total_packets("total_packets", metric_unit::PACKETS)
@@ -98,16 +373,17 @@ struct flow_manager::private_data
 
     size_t num_endpoints;
 
-    std::array< std::optional< packet_proc_flow >, MAX_NUM_FLOWS >     rx_proc_flows;
-    std::array< std::optional< packet_proc_flow >, MAX_NUM_FLOWS >     tx_proc_flows;
-
-    std::array< std::unique_ptr< flow_endpoint_base >, MAX_NUM_FLOWS > proc_endpoints;
+    // Sized once at load time, indexed by endpoint id
+    std::vector< endpoint_context > endpoints;
 
     std::unique_ptr<flow_executor_base<flow_manager>> executor;
 
     std::shared_ptr<flow_database> flow_database_ptr;
 
 #if TELEMETRY_ENABLED == 1
+    // Chains swapped in by reload register their metrics here
+    telemetry_distributor* telemetry = nullptr;
+
     metric_group flow_metric_grp;
 
     per_lcore_metric<uint64_t> m_total_packets;
@@ -119,7 +395,7 @@ struct flow_manager::private_data
 #endif
 };
 
-flow_manager::flow_manager() {
+flow_manager::flow_manager() : default_burst_limits {BURST_SIZE, BURST_SIZE} {
 
 }
 
@@ -136,67 +412,156 @@ void flow_manager::load(flow_program prog) {
         throw std::runtime_error("cannot replace an active flow program");
     }
 
-    pdata = std::make_unique<private_data>(1);
+    size_t num_endpoints = prog.get_num_flow_configs();
+
+    // Endpoint ids at and above PORT_ID_DROP are reserved for special destinations
+    if ( num_endpoints >= PORT_ID_DROP ) {
+        throw std::runtime_error(fmt::format("too many endpoints: {}", num_endpoints));
+    }
+
+    // The distributor rings of the old program have to be gone before the new ones with the same names get created
+    pdata.reset();
+
+    pdata = std::make_unique<private_data>(num_endpoints, 1);
 
     pdata->flow_database_ptr = prog.get_flow_database();
 
+    pdata->distributor.set_multicast_groups(build_multicast_groups(prog, num_endpoints));
+
     size_t index = 0;
 
     // Sick iteration! Whoop
     for(auto& flow : prog) {
+        endpoint_context& ep_ctx = pdata->endpoints[index];
 
-        pdata->proc_endpoints[index] = flow.detach_endpoint();
+        ep_ctx.endpoint = flow.detach_endpoint();
 
-        pdata->rx_proc_flows[index].emplace();
-        pdata->tx_proc_flows[index].emplace();
+        burst_size_limits burst_limits = flow.get_burst_limits().value_or(default_burst_limits);
 
-        for(auto& proc : flow_proc_iterator<flow_dir::RX>(flow)) {
-            pdata->rx_proc_flows[index]->add_proc(std::move(proc));
-        }
+        ep_ctx.rx_burst_size.emplace(burst_limits);
+        ep_ctx.tx_burst_size = burst_limits.max_size;
 
-        for(auto& proc : flow_proc_iterator<flow_dir::TX>(flow)) {
-            pdata->tx_proc_flows[index]->add_proc(std::move(proc));
+        if ( burst_limits.min_size != burst_limits.max_size ) {
+            log(LOG_INFO,
+                "Endpoint {} uses adaptive bursts of {} to {} packets",
+                ep_ctx.endpoint->get_name(),
+                burst_limits.min_size,
+                burst_limits.max_size);
         }
 
-        {
-            const auto chain_names = pdata->rx_proc_flows[index]->get_chain_names();
+        ep_ctx.rx_flow = build_proc_flow< flow_dir::RX >(flow, ep_ctx.endpoint->get_name());
+        ep_ctx.tx_flow = build_proc_flow< flow_dir::TX >(flow, ep_ctx.endpoint->get_name());
 
-            log(LOG_INFO, "Loaded RX processing chain for endpoint {}: ", pdata->proc_endpoints[index]->get_name());
+        ep_ctx.active_rx_flow.store(ep_ctx.rx_flow.get());
+        ep_ctx.active_tx_flow.store(ep_ctx.tx_flow.get());
 
-            for ( const auto& name : chain_names ) {
-                log(LOG_INFO, "proc : {}", name);
-            }
-        }
+        ++index;
 
-        {
-            const auto chain_names = pdata->tx_proc_flows[index]->get_chain_names();
+    }
+}
 
-            log(LOG_INFO, "Loaded TX processing chain for endpoint {}: ", pdata->proc_endpoints[index]->get_name());
+void flow_manager::reload(flow_program prog) {
+    if(!pdata) {
+        throw std::runtime_error("no program loaded");
+    }
 
-            for ( const auto& name : chain_names ) {
-                log(LOG_INFO, "proc : {}", name);
-            }
-        }
+    if ( prog.get_num_flow_configs() != pdata->num_endpoints ) {
+        throw std::runtime_error(fmt::format(
+            "reloaded program has {} flows but {} endpoints are loaded", prog.get_num_flow_configs(), pdata->num_endpoints));
+    }
+
+    std::unique_ptr< const multicast_group_table > groups = build_multicast_groups(prog, pdata->num_endpoints);
+
+    // Alternating rx and tx. Holds the new chains until they are swapped in and the old ones afterwards
+    std::vector< std::unique_ptr< packet_proc_flow > > proc_flows;
+
+    size_t index = 0;
+
+    for(auto& flow : prog) {
+        const std::string& endpoint_name = pdata->endpoints[index].endpoint->get_name();
+
+        proc_flows.push_back(build_proc_flow< flow_dir::RX >(flow, endpoint_name));
+        proc_flows.push_back(build_proc_flow< flow_dir::TX >(flow, endpoint_name));
 
         ++index;
+    }
+
+#if TELEMETRY_ENABLED == 1
+    if ( pdata->telemetry ) {
+        for ( auto& proc_flow : proc_flows ) {
+            proc_flow->init_telemetry(*pdata->telemetry);
+        }
+    }
+#endif
 
+    // Per lcore state is set up here, before any lcore can see the new chains. If the flows don't run, start does it
+    if ( pdata->active.load() ) {
+        for ( index = 0; index < pdata->num_endpoints; ++index ) {
+            init_chain_lcores(*pdata->executor, index, *proc_flows[index * 2], *proc_flows[index * 2 + 1]);
+        }
     }
 
-    pdata->num_endpoints = index;
+    // All chains are swapped before waiting so that they share one grace period. An lcore may still see the old chain
+    // of one endpoint next to the new chain of another for a burst
+    for ( index = 0; index < pdata->num_endpoints; ++index ) {
+        endpoint_context& ep_ctx = pdata->endpoints[index];
 
+        std::swap(ep_ctx.rx_flow, proc_flows[index * 2]);
+        std::swap(ep_ctx.tx_flow, proc_flows[index * 2 + 1]);
+
+        ep_ctx.active_rx_flow.store(ep_ctx.rx_flow.get(), std::memory_order_release);
+        ep_ctx.active_tx_flow.store(ep_ctx.tx_flow.get(), std::memory_order_release);
+    }
+
+    groups = pdata->distributor.set_multicast_groups(std::move(groups));
+
+    // rcu_synchronize waits for every active lcore to pass flow_purge_checkpoint, which only happens at the end of a loop
+    // iteration. After that nobody can be using the old chains or the old multicast groups anymore
+    if ( pdata->active.load() ) {
+        pdata->flow_database_ptr->rcu_synchronize();
+    }
 
-    pdata->distributor.set_num_active_ports(pdata->num_endpoints);
+    proc_flows.clear();
+
+    groups.reset();
+
+    log(LOG_INFO, "Reloaded processing chains of {} endpoints", pdata->num_endpoints);
+}
+
+std::vector< flow_endpoint_base* > flow_manager::get_endpoints() const {
+    std::vector< flow_endpoint_base* > endpoints;
+
+    if ( pdata ) {
+        for ( auto& ep_ctx : pdata->endpoints ) {
+            endpoints.push_back(ep_ctx.endpoint.get());
+        }
+    }
+
+    return endpoints;
+}
+
+std::shared_ptr< flow_database > flow_manager::get_flow_database() const {
+    return pdata ? pdata->flow_database_ptr : nullptr;
 }
 
 #if TELEMETRY_ENABLED == 1
 void flow_manager::init_telemetry(telemetry_distributor& telemetry) {
+    pdata->telemetry = &telemetry;
+
     telemetry.add_metric(pdata->flow_metric_grp);
 
-    for(auto& endpoint : pdata->proc_endpoints) {
-        if(endpoint) {
-            endpoint->init_telemetry(telemetry);
+    packet_drop_stats.init_telemetry(telemetry);
+
+    for(auto& ep_ctx : pdata->endpoints) {
+        if(ep_ctx.endpoint) {
+            ep_ctx.endpoint->init_telemetry(telemetry);
         }
     }
+
+    for ( size_t index = 0; index < pdata->num_endpoints; ++index ) {
+        pdata->endpoints[index].rx_flow->init_telemetry(telemetry);
+        pdata->endpoints[index].tx_flow->init_telemetry(telemetry);
+    }
 }
 #endif
 
@@ -213,16 +578,26 @@ void flow_manager::start(const std::vector<lcore_info>& available_cores) {
 
     std::vector<int> endpoint_numa_ids;
 
-    for(auto& ep : pdata->proc_endpoints) {
-        if(ep) {
+    for(auto& ep_ctx : pdata->endpoints) {
+        if(auto& ep = ep_ctx.endpoint) {
             endpoint_numa_ids.push_back(rte_eth_dev_socket_id(ep->get_port_num()));
-
-            ep->start();
         }
     }
 
     pdata->executor->setup(endpoint_numa_ids, 1, available_cores);
 
+    for ( size_t index = 0; index < pdata->num_endpoints; ++index ) {
+        endpoint_context& ep_ctx = pdata->endpoints[index];
+
+        init_chain_lcores(*pdata->executor, index, *ep_ctx.rx_flow, *ep_ctx.tx_flow);
+    }
+
+    for(auto& ep_ctx : pdata->endpoints) {
+        if(auto& ep = ep_ctx.endpoint) {
+            ep->start();
+        }
+    }
+
     pdata->active.store(true);
 
     pdata->executor->start(&flow_manager::endpoint_work_callback, &flow_manager::distributor_work_callback);
@@ -239,8 +614,8 @@ void flow_manager::stop() {
 
     pdata->executor->stop();
 
-    for(auto& ep : pdata->proc_endpoints) {
-        if(ep) {
+    for(auto& ep_ctx : pdata->endpoints) {
+        if(auto& ep = ep_ctx.endpoint) {
             ep->stop();
         }
     }
@@ -248,10 +623,21 @@ void flow_manager::stop() {
     pdata->active.store(false);
 }
 
+void flow_manager::poll_control() {
+    if ( !pdata || !pdata->active.load() ) {
+        return;
+    }
+
+    for ( size_t index = 0; index < pdata->num_endpoints; ++index ) {
+        pdata->endpoints[index].rx_flow->control_poll();
+        pdata->endpoints[index].tx_flow->control_poll();
+    }
+}
+
 void flow_manager::endpoint_work_callback(const size_t* endpoint_ids, size_t num_endpoint_ids, std::atomic_bool& run_state) {
     private_data* p = pdata.get();
 
-    static_mbuf_vec<BURST_SIZE> mbuf_vec;
+    static_mbuf_vec<MAX_BURST_SIZE> mbuf_vec;
 
     auto lcore_id = rte_lcore_id();
 
@@ -271,15 +657,21 @@ void flow_manager::endpoint_work_callback(const size_t* endpoint_ids, size_t num
 
             // log(LOG_INFO, "lcore{} : endpoint callback - handling endpoint {}", lcore_id, ep_id);
 
-            auto& ep = p->proc_endpoints[ep_id];
+            endpoint_context& ep_ctx = p->endpoints[ep_id];
+
+            mbuf_vec.set_capacity(ep_ctx.rx_burst_size->get());
 
-            ep->rx_burst(mbuf_vec);
+            ep_ctx.endpoint->rx_burst(mbuf_vec);
+
+            ep_ctx.rx_burst_size->update(mbuf_vec.size());
 
 //            if(mbuf_vec.size()) {
 //                log(LOG_DEBUG, "lcore{} : pulled {} packets from endpoint {}", rte_lcore_id(), mbuf_vec.size(), ep_id);
 //            }
 
-            p->rx_proc_flows[ep_id]->process(mbuf_vec, ctx);
+            packet_proc_flow* rx_flow = ep_ctx.active_rx_flow.load(std::memory_order_acquire);
+
+            rx_flow->process(mbuf_vec, ctx);
 
             p->distributor.push_packets(ep_id, 0, mbuf_vec);
 
@@ -301,11 +693,11 @@ void flow_manager::endpoint_work_callback(const size_t* endpoint_ids, size_t num
 void flow_manager::distributor_work_callback(const size_t* distributor_ids, size_t num_distributor_ids, std::atomic_bool& run_state) {
     private_data* p = pdata.get();
 
-    static_mbuf_vec<BURST_SIZE> mbuf_vec;
+    static_mbuf_vec<MAX_BURST_SIZE> mbuf_vec;
 
     auto lcore_id = rte_lcore_id();
 
-    //flow_proc_context ctx(flow_dir::TX, 0);
+    flow_proc_context ctx(flow_dir::TX, 0);
 
     p->flow_database_ptr->set_lcore_active(lcore_id);
 
@@ -317,10 +709,26 @@ void flow_manager::distributor_work_callback(const size_t* distributor_ids, size
         // log(LOG_INFO, "lcore{} : distributor callback - collecting packets", lcore_id);
 
         for ( uint16_t index = 0; index < (uint16_t) p->num_endpoints; ++index ) {
-            //ctx.set_related_endpoint_id(index);
+            ctx.set_related_endpoint_id(index);
+
+            mbuf_vec.set_capacity(p->endpoints[index].tx_burst_size);
 
             uint16_t num_pulled_bufs = p->distributor.pull_packets(index, 0, mbuf_vec);
 
+            if ( num_pulled_bufs ) {
+                packet_proc_flow* tx_flow = p->endpoints[index].active_tx_flow.load(std::memory_order_acquire);
+
+                if ( !tx_flow->empty() ) {
+                    if ( tx_flow->writes_packets() ) {
+                        unshare_packets(mbuf_vec);
+                    }
+
+                    tx_flow->process(mbuf_vec, ctx);
+
+                    drop_tx_verdicts(mbuf_vec);
+                }
+            }
+
 #if TELEMETRY_ENABLED == 1
             p->m_total_packets.add(num_pulled_bufs);
 
@@ -330,7 +738,11 @@ void flow_manager::distributor_work_callback(const size_t* distributor_ids, size
 #endif
             // log(LOG_INFO, "lcore{} : transmitting {} packets on endpoint {}", lcore_id, num_pulled_bufs, index);
 
-            p->proc_endpoints[index]->tx_burst(mbuf_vec);
+            p->endpoints[index].endpoint->tx_burst(mbuf_vec);
+
+            if ( unlikely(mbuf_vec.size() != 0) ) {
+                packet_drop_stats.record(drop_reason::TX_FAILED, mbuf_vec.begin(), mbuf_vec.size());
+            }
 
             // This will free all remaining mbufs if there are any
             mbuf_vec.free();
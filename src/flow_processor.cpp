@@ -7,6 +7,9 @@
 #include <common/common.hpp>
 
 #include <flow_processor.hpp>
+#include <flow_branch.hpp>
+#include <lua_packet_filter.hpp>
+#include <rule_filter.hpp>
 
 #include <common/generic_factory.hpp>
 #include <common/file_utils.hpp>
@@ -42,7 +45,8 @@ uint16_t ingress_packet_validator::process(mbuf_vec_base& mbuf_vec, flow_proc_co
 
             auto* packet_info = get_private_packet_info(current_packet);
 
-            packet_info->new_flow = false;
+            packet_info->new_flow  = false;
+            packet_info->flow_info = nullptr;
 
             packet_info->src_endpoint_id = ctx.get_related_endpoint_id();
             packet_info->dst_endpoint_id = PORT_ID_BROADCAST;
@@ -58,13 +62,19 @@ uint16_t ingress_packet_validator::process(mbuf_vec_base& mbuf_vec, flow_proc_co
 
                 get_ether_header_info(ether_header, &l2_len, &tci, &l2_proto);
 
+                packet_info->vlan = 0;
+
                 if ( tci ) {
-                    packet_info->vlan = rte_le_to_cpu_16(tci) & 0x0fffU;
+                    packet_info->vlan = rte_be_to_cpu_16(tci) & 0x0fffU;
 
-                    rte_vlan_strip(current_packet);
-                }
+                    // Stripping moves the ethernet header up to where the tag was
+                    if ( rte_vlan_strip(current_packet) == 0 ) {
+                        l2_len = sizeof(rte_ether_hdr);
 
-                //l2_len = sizeof(rte_ether_hdr);
+                        // The tag is gone, so is its length
+                        packet_len = rte_pktmbuf_pkt_len(current_packet);
+                    }
+                }
 
                 packet_info->ether_type = l2_proto;
                 packet_info->l3_offset  = l2_len;
@@ -90,6 +100,8 @@ uint16_t ingress_packet_validator::process(mbuf_vec_base& mbuf_vec, flow_proc_co
                 (size_t)current_packet->l4_len);*/
 
             if ( unlikely(drop_packet) ) {
+                packet_drop_stats.record(drop_reason::INVALID_PACKET, current_packet);
+
                 rte_pktmbuf_free(current_packet);
 
                 mbuf_vec.clear_packet(packet_index);
@@ -182,8 +194,15 @@ uint16_t flow_classifier::process(mbuf_vec_base& mbuf_vec, flow_proc_context& ct
                 if ( entry_created ) {
                     
                     packet_info->flow_info->flow_hash = fhash;
+                    packet_info->flow_info->first_seen = packet_info->flow_info->last_used;
+                    packet_info->flow_info->packets = 0;
+                    packet_info->flow_info->bytes = 0;
                     packet_info->flow_info->mark = 0;
                     packet_info->flow_info->overwrite_dst_port = PORT_ID_IGNORE;
+                    packet_info->flow_info->verdict_epoch = 0;
+
+                    // Whatever the previous owner of this entry left behind must not leak into the new flow
+                    std::memset(get_flow_local_storage(packet_info->flow_info), 0, FLOW_LOCAL_STORAGE_SIZE);
 
                     const rte_ether_hdr* ether_header =
                         rte_pktmbuf_mtod_offset(current_packet, struct rte_ether_hdr*, 0);
@@ -195,10 +214,27 @@ uint16_t flow_classifier::process(mbuf_vec_base& mbuf_vec, flow_proc_context& ct
 
                     packet_info->flow_info->dst_addr = ipv4_header->dst_addr;
                     packet_info->flow_info->src_addr = ipv4_header->src_addr;
+                    packet_info->flow_info->ipv4_proto = ipv4_header->next_proto_id;
+
+                    // TCP and UDP both start with the port pair. Network byte order like the addresses
+                    if ( (packet_info->ipv4_type == IP_PROTO_TCP || packet_info->ipv4_type == IP_PROTO_UDP) &&
+                         !packet_info->is_fragment ) {
+                        const rte_udp_hdr* l4_header =
+                            rte_pktmbuf_mtod_offset(current_packet, struct rte_udp_hdr*, packet_info->l4_offset);
+
+                        packet_info->flow_info->src_port = l4_header->src_port;
+                        packet_info->flow_info->dst_port = l4_header->dst_port;
+                    } else {
+                        packet_info->flow_info->src_port = 0;
+                        packet_info->flow_info->dst_port = 0;
+                    }
 
                     packet_info->new_flow = true;
                 }
 
+                ++packet_info->flow_info->packets;
+                packet_info->flow_info->bytes += rte_pktmbuf_pkt_len(current_packet);
+
                 //log(LOG_DEBUG, "pkt [flow {}] : {} -> {}", fhash, packet_info->flow_info->src_addr, packet_info->flow_info->dst_addr);
             }
         }
@@ -210,185 +246,104 @@ uint16_t flow_classifier::process(mbuf_vec_base& mbuf_vec, flow_proc_context& ct
 void flow_classifier::init(const flow_proc_builder& builder) {}
 
 
-struct lua_packet_accessor
-{
-    rte_mbuf* mbuf;
-
-    packet_private_info* packet_info;
-
-    flow_info_ipv4* flow_info;
-
+void flow_group_table::build(mbuf_vec_base& mbuf_vec) noexcept {
+    uint16_t num = mbuf_vec.size();
 
-    void init(rte_mbuf* mb) {
-        mbuf = mb;
+    if ( unlikely(num > MAX_BURST_SIZE) ) {
+        invalidate();
 
-        packet_info = get_private_packet_info(mbuf);
-
-        flow_info = packet_info->flow_info;
+        return;
     }
 
-    bool is_arp() const noexcept {
-        return (packet_info->ether_type == ether_type_info< RTE_ETHER_TYPE_ARP >::ether_type_be);
-    }
+    num_groups = 0;
 
-    bool is_ipv4() const noexcept {
-        return (packet_info->ether_type == ether_type_info< RTE_ETHER_TYPE_IPV4 >::ether_type_be);
-    }
+    uint16_t last_group = NO_GROUP;
 
-    bool is_udp() const noexcept {
-        return is_ipv4() && (packet_info->ipv4_type == IP_PROTO_UDP);
-    }
-
-    bool is_tcp() const noexcept {
-        return is_ipv4() && (packet_info->ipv4_type == IP_PROTO_TCP);
-    }
-
-    bool is_icmp() const noexcept {
-        return is_ipv4() && (packet_info->ipv4_type == IP_PROTO_ICMP);
-    }
-
-    uint32_t get_dst_ipv4() const noexcept {
-        return (flow_info != nullptr) ? flow_info->dst_addr : 0;
-    }
-
-    uint32_t get_src_ipv4() const noexcept {
-        return (flow_info != nullptr) ? flow_info->src_addr : 0;
-    }
-
-    uint16_t get_src_endpoint() const noexcept {
-        return packet_info->src_endpoint_id;
-    }
-
-    uint16_t get_dst_endpoint() const noexcept {
-        return packet_info->dst_endpoint_id;
-    }
+    for ( uint16_t packet_index = 0; packet_index < num; ++packet_index ) {
+        rte_mbuf*       current_packet = mbuf_vec.begin()[packet_index];
+        flow_info_ipv4* flow_info      = nullptr;
 
-    uint64_t get_flow_id() const noexcept {
-        return flow_info->flow_hash;
-    }
-};
-
-static constexpr int PACKET_ACTION_DROP      = -1;
-static constexpr int PACKET_ACTION_BROADCAST = -2;
-
-
-lua_packet_filter::lua_packet_filter(std::string                            name,
-                                     std::shared_ptr< dpdk_packet_mempool > mempool,
-                                     std::shared_ptr< flow_database >       flow_database_ptr) :
-    flow_processor(std::move(name), std::move(mempool)), flow_database_ptr(std::move(flow_database_ptr)), eval_flow_once(false) {}
-
-uint16_t lua_packet_filter::process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) {
-
-
-    for ( auto packet : mbuf_vec ) {
-        lua_packet_accessor packet_accessor;
+        if ( likely(current_packet != nullptr) ) {
+            flow_info = get_private_packet_info(current_packet)->flow_info;
+        }
 
-        packet_accessor.init(packet);
+        if ( unlikely(flow_info == nullptr) ) {
+            group_ids[packet_index] = NO_GROUP;
 
-        if ( !packet_accessor.flow_info ) {
-            // Just ignore packets without a valid flow for now...
-            // Can be improved later™
             continue;
         }
 
-        if(eval_flow_once) {
-            uint16_t overwrite_dst_port = packet_accessor.flow_info->overwrite_dst_port;
+        // Consecutive packets very often belong to the same flow. Only search if that's not the case.
+        if ( last_group == NO_GROUP || groups[last_group].flow_info != flow_info ) {
+            last_group = NO_GROUP;
+
+            for ( uint16_t group_idx = 0; group_idx < num_groups; ++group_idx ) {
+                if ( groups[group_idx].flow_info == flow_info ) {
+                    last_group = group_idx;
+                    break;
+                }
+            }
 
-            if(overwrite_dst_port != PORT_ID_IGNORE) {
-                packet_accessor.packet_info->dst_endpoint_id = overwrite_dst_port;
+            if ( last_group == NO_GROUP ) {
+                last_group = num_groups++;
 
-                continue;
+                groups[last_group].flow_info = flow_info;
+                groups[last_group].count     = 0;
             }
         }
 
-        auto result = process_function.call(packet_accessor);
+        ++groups[last_group].count;
 
-        if ( unlikely(result.status() != sol::call_status::ok) ) {
-            sol::error err = result;
+        group_ids[packet_index] = last_group;
+    }
 
-            log(LOG_INFO, "lua process call failed {}", err.what());
-        } else {
-            auto ret = result.get< int >();
+    // Turn the counts into offsets and scatter the packet indices
+    uint16_t offset = 0;
 
-            if ( ret == PACKET_ACTION_DROP ) {
-                packet_accessor.packet_info->dst_endpoint_id = PORT_ID_DROP;
-            } else if ( ret == PACKET_ACTION_BROADCAST ) {
-                packet_accessor.packet_info->dst_endpoint_id = PORT_ID_BROADCAST;
-            } else if(ret >= 0) {
-                packet_accessor.packet_info->dst_endpoint_id = (uint16_t)ret;
-            }
+    for ( uint16_t group_idx = 0; group_idx < num_groups; ++group_idx ) {
+        groups[group_idx].first = offset;
 
-            if(eval_flow_once) {
-                packet_accessor.flow_info->overwrite_dst_port = packet_accessor.packet_info->dst_endpoint_id;
+        offset += groups[group_idx].count;
 
-                rte_wmb();
-            }
-        }
+        groups[group_idx].count = 0;
     }
 
-    return mbuf_vec.size();
-}
-
-void lua_packet_filter::init(const flow_proc_builder& builder) {
+    for ( uint16_t packet_index = 0; packet_index < num; ++packet_index ) {
+        uint16_t group_idx = group_ids[packet_index];
 
-    auto lua_script_filename = builder.get_param("script_filename");
+        if ( group_idx != NO_GROUP ) {
+            group& g = groups[group_idx];
 
-    if ( !lua_script_filename.has_value() ) {
-        throw std::runtime_error("script_filename not set");
+            indices[g.first + g.count++] = packet_index;
+        }
     }
 
-    lua.load_stdlibs();
+    burst_base  = mbuf_vec.begin();
+    num_packets = num;
+}
 
-    auto script_content = load_file_as_string(lua_script_filename.value());
 
-    lua.execute(script_content, lua_script_filename.value());
+flow_grouper::flow_grouper(std::string                            name,
+                           std::shared_ptr< dpdk_packet_mempool > mempool,
+                           std::shared_ptr< flow_database >       flow_database_ptr) :
+    flow_processor(std::move(name), std::move(mempool)) {}
 
-    auto init_func = lua.get< sol::function >("init");
+uint16_t flow_grouper::process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) {
+    ctx.get_flow_groups().build(mbuf_vec);
 
-    if ( init_func ) {
-        init_func->call(get_name());
-    } else {
-        log(LOG_WARN, "lua packet filter script {} has no init function", lua_script_filename.value());
-    }
+    return mbuf_vec.size();
+}
 
-    auto proc_func = lua.get< sol::function >("process");
+void flow_grouper::init(const flow_proc_builder& builder) {}
 
-    if ( !proc_func.has_value() ) {
-        throw std::runtime_error(fmt::format("{} does not expose a process function", lua_script_filename.value()));
-    } else {
-        process_function = proc_func.value();
-    }
 
-    lua.set_function("ipv4_to_str", [](uint32_t ipv4) -> std::string { return ipv4_to_str(ipv4); });
-
-    lua.set("DROP", PACKET_ACTION_DROP);
-    lua.set("BROADCAST", PACKET_ACTION_BROADCAST);
-
-    lua.get().new_usertype< lua_packet_accessor >("packet",
-                                                  sol::no_constructor,
-                                                  "is_arp",
-                                                  &lua_packet_accessor::is_arp,
-                                                  "is_ipv4",
-                                                  &lua_packet_accessor::is_ipv4,
-                                                  "is_udp",
-                                                  &lua_packet_accessor::is_udp,
-                                                  "is_tcp",
-                                                  &lua_packet_accessor::is_tcp,
-                                                  "is_icmp",
-                                                  &lua_packet_accessor::is_icmp,
-                                                  "get_dst_ipv4",
-                                                  &lua_packet_accessor::get_dst_ipv4,
-                                                  "get_src_ipv4",
-                                                  &lua_packet_accessor::get_src_ipv4,
-                                                  "get_src_endpoint_id",
-                                                  &lua_packet_accessor::get_src_endpoint,
-                                                  "get_dst_endpoint_id",
-                                                  &lua_packet_accessor::get_dst_endpoint);
-
-    auto eval_flow_once_opt = builder.get_param("eval_flow_once");
-
-    if(eval_flow_once_opt.has_value()) {
-        eval_flow_once = (eval_flow_once_opt.value() == "true");
+// Instantiated here, next to the process functions of the stages, so that they can actually be inlined
+void fuse_flow_processors(std::vector< std::unique_ptr< flow_processor > >& procs) {
+    for ( size_t idx = 0; idx < procs.size(); ++idx ) {
+        // Longest sequence first
+        fused_flow_processor< ingress_packet_validator, flow_classifier, flow_grouper >::try_fuse(procs, idx) ||
+            fused_flow_processor< ingress_packet_validator, flow_classifier >::try_fuse(procs, idx) ||
+            fused_flow_processor< flow_classifier, flow_grouper >::try_fuse(procs, idx);
     }
 }
 
@@ -396,7 +351,10 @@ void lua_packet_filter::init(const flow_proc_builder& builder) {
 static auto packet_proc_factory = create_factory< flow_processor >()
                                       .append< ingress_packet_validator >("ingress_packet_validator")
                                       .append< flow_classifier >("flow_classifier")
-                                      .append< lua_packet_filter >("lua_packet_filter");
+                                      .append< flow_grouper >("flow_grouper")
+                                      .append< flow_branch >("flow_branch")
+                                      .append< lua_packet_filter >("lua_packet_filter")
+                                      .append< rule_filter >("rule_filter");
 
 std::unique_ptr< flow_processor > create_flow_processor(std::shared_ptr< flow_proc_builder >          proc_builder,
                                                         const std::shared_ptr< dpdk_packet_mempool >& mempool,
@@ -3,7 +3,10 @@
 #include <zmq.hpp>
 
 metric_base::~metric_base() {
-
+    // Metrics of processors retired by a chain reload go away while the distributor keeps running
+    if ( owning_distributor ) {
+        owning_distributor->remove_metric(*this);
+    }
 }
 
 
@@ -36,8 +39,6 @@ void metric_group::add_metric(metric_base& m) {
     std::lock_guard<std::mutex> guard(lk);
 
     child_metrics.push_back(std::ref(m));
-
-    m.owning_distributor = owning_distributor;
 }
 
 void metric_group::remove_metric(metric_base& m) {
@@ -48,8 +49,6 @@ void metric_group::remove_metric(metric_base& m) {
     while(it != child_metrics.end()) {
         if(std::addressof(it->get()) == std::addressof(m)) {
             it = child_metrics.erase(it);
-
-            m.owning_distributor = nullptr;
         } else {
             ++it;
         }
@@ -98,6 +97,10 @@ telemetry_distributor::~telemetry_distributor() {
         {
             std::lock_guard< std::mutex > guard(pdata->lk);
 
+            for ( auto& m : pdata->metrics ) {
+                m.get().owning_distributor = nullptr;
+            }
+
             pdata->metrics.clear();
         }
 
@@ -0,0 +1,248 @@
+local ffi = require("ffi")
+local bit = require("bit")
+
+-- Must match the layout of the corresponding C++ types. The layout is verified when a filter loads this file.
+ffi.cdef[[
+typedef struct fo_ether_addr {
+    uint8_t addr_bytes[6];
+} fo_ether_addr;
+
+typedef struct flow_info_ipv4 {
+    uint64_t flow_hash;
+    uint64_t last_used;
+    uint64_t first_seen;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t mark;
+    uint32_t src_addr;
+    uint32_t dst_addr;
+    uint16_t src_port;
+    uint16_t dst_port;
+    fo_ether_addr ether_src;
+    fo_ether_addr ether_dst;
+    uint16_t overwrite_dst_port;
+    uint8_t ipv4_proto;
+    uint32_t verdict_epoch;
+} flow_info_ipv4;
+
+typedef struct packet_private_info {
+    flow_info_ipv4* flow_info;
+    bool new_flow;
+    uint16_t src_endpoint_id;
+    uint16_t dst_endpoint_id;
+    uint16_t l3_offset;
+    uint16_t l4_offset;
+    uint16_t ether_type;
+    uint16_t vlan;
+    uint8_t ipv4_type;
+    uint16_t ipv4_len;
+    bool is_fragment;
+} packet_private_info;
+
+typedef struct lua_packet_view {
+    void* mbuf;
+    packet_private_info* info;
+    flow_info_ipv4* flow;
+    uint8_t* storage;
+    uint8_t* data;
+    uint32_t data_len;
+    uint32_t pkt_len;
+} lua_packet_view;
+
+typedef const uint8_t* (*fo_packet_read_fn)(void* mbuf, uint32_t offset, uint32_t len, void* buf);
+typedef bool (*fo_packet_compare_fn)(void* mbuf, uint32_t offset, const char* data, uint32_t len);
+typedef int64_t (*fo_packet_find_fn)(void* mbuf, uint32_t offset, uint32_t max_len, const char* needle, uint32_t needle_len);
+
+typedef struct fo_ether_hdr {
+    fo_ether_addr dst_addr;
+    fo_ether_addr src_addr;
+    uint16_t ether_type;
+} fo_ether_hdr;
+
+typedef struct fo_ipv4_hdr {
+    uint8_t version_ihl;
+    uint8_t type_of_service;
+    uint16_t total_length;
+    uint16_t packet_id;
+    uint16_t fragment_offset;
+    uint8_t time_to_live;
+    uint8_t next_proto_id;
+    uint16_t hdr_checksum;
+    uint32_t src_addr;
+    uint32_t dst_addr;
+} fo_ipv4_hdr;
+
+typedef struct fo_tcp_hdr {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t sent_seq;
+    uint32_t recv_ack;
+    uint8_t data_off;
+    uint8_t tcp_flags;
+    uint16_t rx_win;
+    uint16_t cksum;
+    uint16_t tcp_urp;
+} fo_tcp_hdr;
+
+typedef struct fo_udp_hdr {
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t dgram_len;
+    uint16_t dgram_cksum;
+} fo_udp_hdr;
+]]
+
+local packet_read = ffi.cast("fo_packet_read_fn", __packet_read)
+local packet_compare = ffi.cast("fo_packet_compare_fn", __packet_compare)
+local packet_find = ffi.cast("fo_packet_find_fn", __packet_find)
+
+__packet_read = nil
+__packet_compare = nil
+__packet_find = nil
+
+-- Bounce buffer for reads that cross a segment boundary
+local read_buf = ffi.new("uint8_t[4]")
+
+local ether_hdr_ptr = ffi.typeof("fo_ether_hdr*")
+local ipv4_hdr_ptr = ffi.typeof("fo_ipv4_hdr*")
+local tcp_hdr_ptr = ffi.typeof("fo_tcp_hdr*")
+local udp_hdr_ptr = ffi.typeof("fo_udp_hdr*")
+
+IP_PROTO_ICMP = 0x01
+IP_PROTO_TCP = 0x06
+IP_PROTO_UDP = 0x11
+
+-- Header fields are in network byte order
+function ntohs(v)
+    return bit.rshift(bit.bswap(v), 16)
+end
+
+function ntohl(v)
+    return bit.bswap(v)
+end
+
+packet_view = {}
+
+function packet_view.ether(view)
+    return ffi.cast(ether_hdr_ptr, view.data)
+end
+
+function packet_view.ipv4(view)
+    return ffi.cast(ipv4_hdr_ptr, view.data + view.info.l3_offset)
+end
+
+function packet_view.tcp(view)
+    return ffi.cast(tcp_hdr_ptr, view.data + view.info.l4_offset)
+end
+
+function packet_view.udp(view)
+    return ffi.cast(udp_hdr_ptr, view.data + view.info.l4_offset)
+end
+
+local storage_ptr_types = {}
+
+-- Flow local storage of the packet's flow as pointer to ctype (e.g. a struct declared with ffi.cdef by the script).
+-- Zeroed when the flow is created, gone when the flow entry gets recycled. Only valid if view.flow ~= nil
+function packet_view.storage(view, ctype)
+    local ptr_type = storage_ptr_types[ctype]
+
+    if not ptr_type then
+        if ffi.sizeof(ctype) > FLOW_LOCAL_STORAGE_SIZE then
+            error(string.format("%s does not fit into %d bytes of flow local storage", tostring(ctype), FLOW_LOCAL_STORAGE_SIZE))
+        end
+
+        ptr_type = ffi.typeof("$*", ffi.typeof(ctype))
+        storage_ptr_types[ctype] = ptr_type
+    end
+
+    return ffi.cast(ptr_type, view.storage)
+end
+
+-- Pointer to len bytes at offset, either straight into the first segment or to a copy in read_buf. nil if out of range
+local function read_ptr(view, offset, len)
+    if offset >= 0 and offset + len <= view.data_len then
+        return view.data + offset
+    end
+
+    local ptr = packet_read(view.mbuf, offset, len, read_buf)
+
+    if ptr == nil then
+        return nil
+    end
+
+    return ptr
+end
+
+-- Payload readers. Offsets are counted from the start of the frame, values are converted to host byte order.
+-- All of them work across segment boundaries and return nil if the range is not within the packet.
+function packet_view.read_u8(view, offset)
+    local ptr = read_ptr(view, offset, 1)
+
+    return ptr and ptr[0]
+end
+
+function packet_view.read_u16(view, offset)
+    local ptr = read_ptr(view, offset, 2)
+
+    return ptr and bit.bor(bit.lshift(ptr[0], 8), ptr[1])
+end
+
+function packet_view.read_u32(view, offset)
+    local ptr = read_ptr(view, offset, 4)
+
+    return ptr and (ptr[0] * 0x1000000 + bit.bor(bit.lshift(ptr[1], 16), bit.lshift(ptr[2], 8), ptr[3]))
+end
+
+function packet_view.equals(view, offset, str)
+    return offset >= 0 and packet_compare(view.mbuf, offset, str, #str)
+end
+
+-- Offset of the first occurrence of str within [offset, offset + max_len) or nil
+function packet_view.find(view, str, offset, max_len)
+    local pos = packet_find(view.mbuf, offset or 0, max_len or 0xffffffff, str, #str)
+
+    if pos < 0 then
+        return nil
+    end
+
+    return tonumber(pos)
+end
+
+-- First byte after the TCP/UDP header. Same as the l4 offset for everything else
+function packet_view.payload_offset(view)
+    if packet_view.is_tcp(view) then
+        return view.info.l4_offset + bit.rshift(packet_view.tcp(view).data_off, 4) * 4
+    elseif packet_view.is_udp(view) then
+        return view.info.l4_offset + 8
+    end
+
+    return view.info.l4_offset
+end
+
+function packet_view.is_ipv4(view)
+    return view.info.ether_type == 0x0008
+end
+
+function packet_view.is_tcp(view)
+    return view.info.ether_type == 0x0008 and view.info.ipv4_type == IP_PROTO_TCP
+end
+
+function packet_view.is_udp(view)
+    return view.info.ether_type == 0x0008 and view.info.ipv4_type == IP_PROTO_UDP
+end
+
+function packet_view.is_icmp(view)
+    return view.info.ether_type == 0x0008 and view.info.ipv4_type == IP_PROTO_ICMP
+end
+
+function __ffi_cast(ctype, ptr)
+    return ffi.cast(ctype, ptr)
+end
+
+function __ffi_offsetof(ctype, field)
+    return ffi.offsetof(ctype, field)
+end
+
+function __ffi_sizeof(ctype)
+    return ffi.sizeof(ctype)
+end
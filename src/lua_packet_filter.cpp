@@ -0,0 +1,1408 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#include <lua_packet_filter.hpp>
+
+#include <common/file_utils.hpp>
+#include <common/network_utils.hpp>
+
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_errno.h>
+#include <rte_lcore.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+
+#include "lua_ffi.h"
+
+
+static constexpr uint32_t DEFAULT_GC_STEPS_PER_BURST = 1;
+static constexpr uint32_t DEFAULT_GC_BOOST_THRESHOLD_KB = 64 * 1024;
+static constexpr uint32_t DEFAULT_LUA_MEMORY_LIMIT_KB = 128 * 1024;
+
+// Step multiplier while a vm is above gc_boost_threshold_kb
+static constexpr uint32_t GC_BOOST_STEP_FACTOR = 8;
+
+// Scripts must not be able to trigger a full collection on the datapath. Only "count" is passed through.
+static const char* GC_GUARD_SCRIPT = R"(
+local collectgarbage_orig = collectgarbage
+
+function collectgarbage(opt, arg)
+    if opt == "count" then
+        return collectgarbage_orig("count")
+    end
+
+    return 0
+end
+)";
+
+// Reports every trace event of the LuaJIT compiler back to the filter. Does nothing if the jit is not available
+static const char* TRACE_HOOK_SCRIPT = R"(
+if jit and jit.attach then
+    local trace_event = __trace_event
+
+    jit.attach(function(what)
+        trace_event(what)
+    end, "trace")
+end
+
+__trace_event = nil
+)";
+
+static constexpr int PACKET_ACTION_DROP      = -1;
+static constexpr int PACKET_ACTION_BROADCAST = -2;
+
+// Marks an entry of the ffi verdict array the script did not write to
+static constexpr int32_t PACKET_ACTION_NONE = std::numeric_limits< int32_t >::min();
+
+// Set in flow_info_ipv4::verdict_epoch while the control thread still has to decide about the flow
+static constexpr uint32_t VERDICT_PENDING = 0x80000000U;
+
+// Set next to VERDICT_PENDING if overwrite_dst_port still holds the verdict of the previous script. The flow keeps it
+// until the running script decided, so a reload doesn't open a window with new_flow_verdict for every known flow
+static constexpr uint32_t VERDICT_KEPT = 0x40000000U;
+
+// Epochs are unique across all filter instances. A filter that replaces another one on a chain reload must not trust the
+// verdicts its predecessor cached in the flow entries
+static uint32_t next_vm_epoch() {
+    static std::atomic< uint32_t > epoch_counter {0};
+
+    return (epoch_counter.fetch_add(1, std::memory_order_relaxed) + 1) & ~(VERDICT_PENDING | VERDICT_KEPT);
+}
+
+static constexpr size_t FLOW_EVENT_RING_SIZE = 8192;
+
+// Upper bound of flow events handled per control_poll so that a flood of them can't stall the control thread
+static constexpr size_t MAX_FLOW_EVENTS_PER_POLL = 4096;
+
+struct new_flow_request
+{
+    flow_info_ipv4* flow_info;
+
+    // To detect entries that got recycled before the request was handled
+    flow_hash hash;
+};
+
+static std::atomic_uint32_t new_flow_ring_counter {0};
+
+struct ffi_layout_entry
+{
+    const char* ctype;
+
+    // nullptr means: check the size of the whole type
+    const char* field;
+
+    size_t value;
+};
+
+static const ffi_layout_entry ffi_layout[] = {
+    {"flow_info_ipv4", nullptr, sizeof(flow_info_ipv4)},
+    {"flow_info_ipv4", "flow_hash", offsetof(flow_info_ipv4, flow_hash)},
+    {"flow_info_ipv4", "last_used", offsetof(flow_info_ipv4, last_used)},
+    {"flow_info_ipv4", "first_seen", offsetof(flow_info_ipv4, first_seen)},
+    {"flow_info_ipv4", "packets", offsetof(flow_info_ipv4, packets)},
+    {"flow_info_ipv4", "bytes", offsetof(flow_info_ipv4, bytes)},
+    {"flow_info_ipv4", "mark", offsetof(flow_info_ipv4, mark)},
+    {"flow_info_ipv4", "src_addr", offsetof(flow_info_ipv4, src_addr)},
+    {"flow_info_ipv4", "dst_addr", offsetof(flow_info_ipv4, dst_addr)},
+    {"flow_info_ipv4", "src_port", offsetof(flow_info_ipv4, src_port)},
+    {"flow_info_ipv4", "dst_port", offsetof(flow_info_ipv4, dst_port)},
+    {"flow_info_ipv4", "ether_src", offsetof(flow_info_ipv4, ether_src)},
+    {"flow_info_ipv4", "ether_dst", offsetof(flow_info_ipv4, ether_dst)},
+    {"flow_info_ipv4", "overwrite_dst_port", offsetof(flow_info_ipv4, overwrite_dst_port)},
+    {"flow_info_ipv4", "ipv4_proto", offsetof(flow_info_ipv4, ipv4_proto)},
+    {"flow_info_ipv4", "verdict_epoch", offsetof(flow_info_ipv4, verdict_epoch)},
+    {"packet_private_info", nullptr, sizeof(packet_private_info)},
+    {"packet_private_info", "flow_info", offsetof(packet_private_info, flow_info)},
+    {"packet_private_info", "new_flow", offsetof(packet_private_info, new_flow)},
+    {"packet_private_info", "src_endpoint_id", offsetof(packet_private_info, src_endpoint_id)},
+    {"packet_private_info", "dst_endpoint_id", offsetof(packet_private_info, dst_endpoint_id)},
+    {"packet_private_info", "l3_offset", offsetof(packet_private_info, l3_offset)},
+    {"packet_private_info", "l4_offset", offsetof(packet_private_info, l4_offset)},
+    {"packet_private_info", "ether_type", offsetof(packet_private_info, ether_type)},
+    {"packet_private_info", "vlan", offsetof(packet_private_info, vlan)},
+    {"packet_private_info", "ipv4_type", offsetof(packet_private_info, ipv4_type)},
+    {"packet_private_info", "ipv4_len", offsetof(packet_private_info, ipv4_len)},
+    {"packet_private_info", "is_fragment", offsetof(packet_private_info, is_fragment)},
+    {"lua_packet_view", nullptr, sizeof(lua_packet_view)},
+    {"lua_packet_view", "info", offsetof(lua_packet_view, info)},
+    {"lua_packet_view", "flow", offsetof(lua_packet_view, flow)},
+    {"lua_packet_view", "storage", offsetof(lua_packet_view, storage)},
+    {"lua_packet_view", "data", offsetof(lua_packet_view, data)},
+    {"lua_packet_view", "data_len", offsetof(lua_packet_view, data_len)},
+    {"lua_packet_view", "pkt_len", offsetof(lua_packet_view, pkt_len)}};
+
+
+// Entry points for the payload helpers in lua_ffi.lua. Handed over as plain function pointers so that nothing has to be
+// exported from the binary
+static const void* ffi_packet_read(const rte_mbuf* mbuf, uint32_t offset, uint32_t len, void* buf) {
+    return rte_pktmbuf_read(mbuf, offset, len, buf);
+}
+
+static bool ffi_packet_compare(const rte_mbuf* mbuf, uint32_t offset, const char* data, uint32_t len) {
+    return packet_compare(mbuf, offset, data, len);
+}
+
+static int64_t ffi_packet_find(const rte_mbuf* mbuf, uint32_t offset, uint32_t max_len, const char* needle, uint32_t needle_len) {
+    return packet_find(mbuf, offset, max_len, needle, needle_len);
+}
+
+static __inline uint16_t verdict_to_endpoint_id(int verdict, uint16_t current_endpoint_id) {
+    if ( verdict == PACKET_ACTION_DROP ) {
+        return PORT_ID_DROP;
+    } else if ( verdict == PACKET_ACTION_BROADCAST ) {
+        return PORT_ID_BROADCAST;
+    } else if ( verdict >= 0 ) {
+        return (uint16_t) verdict;
+    }
+
+    return current_endpoint_id;
+}
+
+static int parse_verdict(const std::string& verdict_str) {
+    if ( verdict_str == "pass" ) {
+        return PACKET_ACTION_NONE;
+    } else if ( verdict_str == "drop" ) {
+        return PACKET_ACTION_DROP;
+    } else if ( verdict_str == "broadcast" ) {
+        return PACKET_ACTION_BROADCAST;
+    } else if ( verdict_str.rfind("multicast ", 0) == 0 ) {
+        int group_id = std::stoi(verdict_str.substr(10));
+
+        if ( group_id < 0 || group_id >= MAX_MULTICAST_GROUPS ) {
+            throw std::runtime_error(fmt::format("invalid verdict {}", verdict_str));
+        }
+
+        return PORT_ID_MULTICAST_BASE + group_id;
+    }
+
+    int endpoint_id = std::stoi(verdict_str);
+
+    if ( endpoint_id < 0 || endpoint_id >= PORT_ID_DROP ) {
+        throw std::runtime_error(fmt::format("invalid verdict {}", verdict_str));
+    }
+
+    return endpoint_id;
+}
+
+static __inline void apply_to_group(mbuf_vec_base&          mbuf_vec,
+                                    const flow_group_table& flow_groups,
+                                    uint16_t                group_idx,
+                                    uint16_t                dst_endpoint_id) {
+    const auto&     group   = flow_groups[group_idx];
+    const uint16_t* indices = flow_groups.packet_indices(group);
+
+    for ( uint16_t idx = 0; idx < group.count; ++idx ) {
+        get_private_packet_info(mbuf_vec.begin()[indices[idx]])->dst_endpoint_id = dst_endpoint_id;
+    }
+}
+
+
+lua_packet_filter::lua_packet_filter(std::string                            name,
+                                     std::shared_ptr< dpdk_packet_mempool > mempool,
+                                     std::shared_ptr< flow_database >       flow_database_ptr) :
+    flow_processor(std::move(name), std::move(mempool)),
+    flow_database_ptr(std::move(flow_database_ptr)),
+    eval_flow_once(false),
+    group_by_flow(false),
+    use_ffi(false),
+    gc_steps_per_burst(DEFAULT_GC_STEPS_PER_BURST),
+    gc_boost_threshold_kb(DEFAULT_GC_BOOST_THRESHOLD_KB),
+    defer_new_flows(false),
+    new_flow_verdict(PACKET_ACTION_NONE),
+    use_lua_arena(false),
+    lua_memory_limit_kb(DEFAULT_LUA_MEMORY_LIMIT_KB),
+    vm_epoch(next_vm_epoch()),
+    previous_vm_epoch(0),
+    flow_expire_ring(nullptr)
+#if TELEMETRY_ENABLED == 1
+    ,filter_metric_grp(get_name())
+    ,m_gc_steps("gc_steps", metric_unit::NONE)
+    ,m_gc_cycles("gc_cycles", metric_unit::NONE)
+    ,m_gc_max_pause_cycles("gc_max_pause_cycles", metric_unit::NONE)
+    ,m_gc_memory_kb("gc_memory_kb", metric_unit::NONE)
+    ,m_gc_boost("gc_boost", metric_unit::NONE)
+    ,m_invocations("invocations", metric_unit::NONE)
+    ,m_call_cycles("call_cycles", metric_unit::NONE)
+    ,m_errors("errors", metric_unit::NONE)
+    ,m_verdict_forward("verdict_forward", metric_unit::PACKETS)
+    ,m_verdict_drop("verdict_drop", metric_unit::PACKETS)
+    ,m_verdict_broadcast("verdict_broadcast", metric_unit::PACKETS)
+    ,m_verdict_pass("verdict_pass", metric_unit::PACKETS)
+    ,m_verdict_cached("verdict_cached", metric_unit::PACKETS)
+    ,m_trace_started("trace_started", metric_unit::NONE)
+    ,m_trace_compiled("trace_compiled", metric_unit::NONE)
+    ,m_trace_aborted("trace_aborted", metric_unit::NONE)
+    ,m_trace_flushed("trace_flushed", metric_unit::NONE)
+    ,m_new_flows_deferred("new_flows_deferred", metric_unit::NONE)
+    ,m_new_flows_lost("new_flows_lost", metric_unit::NONE)
+    ,m_flows_expired("flows_expired", metric_unit::NONE)
+    ,m_flow_expire_events_lost("flow_expire_events_lost", metric_unit::NONE)
+#endif
+{
+#if TELEMETRY_ENABLED == 1
+    filter_metric_grp.add_metric(m_gc_steps);
+    filter_metric_grp.add_metric(m_gc_cycles);
+    filter_metric_grp.add_metric(m_gc_max_pause_cycles);
+    filter_metric_grp.add_metric(m_gc_memory_kb);
+    filter_metric_grp.add_metric(m_gc_boost);
+    filter_metric_grp.add_metric(m_invocations);
+    filter_metric_grp.add_metric(m_call_cycles);
+    filter_metric_grp.add_metric(m_errors);
+    filter_metric_grp.add_metric(m_verdict_forward);
+    filter_metric_grp.add_metric(m_verdict_drop);
+    filter_metric_grp.add_metric(m_verdict_broadcast);
+    filter_metric_grp.add_metric(m_verdict_pass);
+    filter_metric_grp.add_metric(m_verdict_cached);
+    filter_metric_grp.add_metric(m_trace_started);
+    filter_metric_grp.add_metric(m_trace_compiled);
+    filter_metric_grp.add_metric(m_trace_aborted);
+    filter_metric_grp.add_metric(m_trace_flushed);
+    filter_metric_grp.add_metric(m_new_flows_deferred);
+    filter_metric_grp.add_metric(m_new_flows_lost);
+    filter_metric_grp.add_metric(m_flows_expired);
+    filter_metric_grp.add_metric(m_flow_expire_events_lost);
+#endif
+
+    for ( auto& vm : active_vms ) {
+        vm.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+static __inline uint64_t call_timestamp() {
+#if TELEMETRY_ENABLED == 1
+    return rte_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+void lua_packet_filter::record_call(uint64_t start_cycles, bool call_ok) {
+#if TELEMETRY_ENABLED == 1
+    m_call_cycles.record(rte_rdtsc() - start_cycles);
+    m_invocations.inc();
+
+    if ( unlikely(!call_ok) ) {
+        m_errors.inc();
+    }
+#endif
+}
+
+void lua_packet_filter::record_verdict(int verdict) {
+#if TELEMETRY_ENABLED == 1
+    if ( verdict >= 0 ) {
+        m_verdict_forward.inc();
+    } else if ( verdict == PACKET_ACTION_DROP ) {
+        m_verdict_drop.inc();
+    } else if ( verdict == PACKET_ACTION_BROADCAST ) {
+        m_verdict_broadcast.inc();
+    } else {
+        m_verdict_pass.inc();
+    }
+#endif
+}
+
+bool lua_packet_filter::lookup_flow_verdict(lua_filter_vm&       vm,
+                                            lua_packet_accessor& packet_accessor,
+                                            uint16_t&            dst_endpoint_id) {
+    flow_info_ipv4* flow_info = packet_accessor.flow_info;
+
+    if ( unlikely(!flow_info) ) {
+        return false;
+    }
+
+    bool has_new_flow_hook = vm.new_flow_function.valid();
+
+    if ( eval_flow_once || has_new_flow_hook ) {
+        uint16_t overwrite_dst_port = flow_info->overwrite_dst_port;
+        uint32_t verdict_epoch      = flow_info->verdict_epoch;
+
+        if ( verdict_epoch == vm.epoch ) {
+            if ( overwrite_dst_port != PORT_ID_IGNORE ) {
+#if TELEMETRY_ENABLED == 1
+                m_verdict_cached.inc();
+#endif
+                dst_endpoint_id = overwrite_dst_port;
+
+                return true;
+            }
+
+            // on_new_flow passed, the flow is left to process/process_burst
+            if ( has_new_flow_hook ) {
+                return false;
+            }
+        }
+
+        if ( verdict_epoch == (vm.epoch | VERDICT_PENDING) ) {
+            dst_endpoint_id = verdict_to_endpoint_id(new_flow_verdict, dst_endpoint_id);
+
+            return true;
+        }
+
+        if ( verdict_epoch == (vm.epoch | VERDICT_PENDING | VERDICT_KEPT) ) {
+            dst_endpoint_id = overwrite_dst_port;
+
+            return true;
+        }
+    }
+
+    // Every flow without a verdict of the running script is undecided, not just new ones. After a reload the flows
+    // decided by the old script would otherwise get the default destination without any policy applied
+    if ( !has_new_flow_hook ) {
+        return false;
+    }
+
+    if ( defer_new_flows ) {
+        new_flow_request request {flow_info, flow_info->flow_hash};
+
+        // Decided by the script this one replaced. That verdict stays until the new one arrives
+        bool keep_verdict = vm.previous_epoch && flow_info->verdict_epoch == vm.previous_epoch &&
+                            flow_info->overwrite_dst_port != PORT_ID_IGNORE;
+
+        bool enqueued = (rte_ring_mp_enqueue_elem(new_flow_ring.get(), &request, sizeof(new_flow_request)) == 0);
+
+        if ( likely(enqueued) ) {
+            flow_info->verdict_epoch = vm.epoch | VERDICT_PENDING | (keep_verdict ? VERDICT_KEPT : 0);
+        }
+
+#if TELEMETRY_ENABLED == 1
+        if ( likely(enqueued) ) {
+            m_new_flows_deferred.inc();
+        } else {
+            m_new_flows_lost.inc();
+        }
+#endif
+
+        dst_endpoint_id = keep_verdict ? flow_info->overwrite_dst_port
+                                       : verdict_to_endpoint_id(new_flow_verdict, dst_endpoint_id);
+
+        return true;
+    }
+
+    uint64_t start_cycles = call_timestamp();
+
+    auto result = vm.new_flow_function.call(create_flow_table(vm, *flow_info, get_flow_local_storage(flow_info)));
+
+    bool call_ok = (result.status() == sol::call_status::ok);
+
+    record_call(start_cycles, call_ok);
+
+    if ( unlikely(!call_ok) ) {
+        sol::error err = result;
+
+        log(LOG_INFO, "lua on_new_flow call failed {}", err.what());
+
+        return false;
+    }
+
+    int verdict = result.get< sol::optional< int > >().value_or(PACKET_ACTION_NONE);
+
+    record_verdict(verdict);
+
+    uint16_t flow_dst_endpoint_id = verdict_to_endpoint_id(verdict, PORT_ID_IGNORE);
+
+    // A pass is cached as well. The flow is then left to process/process_burst
+    flow_info->overwrite_dst_port = flow_dst_endpoint_id;
+    rte_smp_wmb();
+    flow_info->verdict_epoch = vm.epoch;
+
+    if ( flow_dst_endpoint_id == PORT_ID_IGNORE ) {
+        return false;
+    }
+
+    dst_endpoint_id = flow_dst_endpoint_id;
+
+    return true;
+}
+
+sol::table lua_packet_filter::create_flow_table(lua_filter_vm& vm, const flow_info_ipv4& info, uint8_t* storage) {
+    sol::table flow = vm.lua.get().create_table(0, 8);
+
+    flow["id"]       = info.flow_hash;
+    flow["src_ip"]   = info.src_addr;
+    flow["dst_ip"]   = info.dst_addr;
+    flow["src_port"] = rte_be_to_cpu_16(info.src_port);
+    flow["dst_port"] = rte_be_to_cpu_16(info.dst_port);
+    flow["proto"]    = info.ipv4_proto;
+    flow["mark"]     = info.mark;
+
+    if ( storage && vm.ffi_cast_function.valid() ) {
+        sol::object storage_ptr = vm.ffi_cast_function("uint8_t*", (void*) storage);
+
+        flow["storage"] = storage_ptr;
+    }
+
+    return flow;
+}
+
+uint16_t lua_packet_filter::evaluate(lua_filter_vm& vm, lua_packet_accessor& packet_accessor) {
+    uint16_t dst_endpoint_id = packet_accessor.packet_info->dst_endpoint_id;
+
+    if ( lookup_flow_verdict(vm, packet_accessor, dst_endpoint_id) || !vm.process_function.valid() ) {
+        return dst_endpoint_id;
+    }
+
+    if ( use_ffi ) {
+        vm.burst_views[0].init(packet_accessor.mbuf);
+    }
+
+    uint64_t start_cycles = call_timestamp();
+
+    auto result = use_ffi ? vm.process_function.call(vm.ffi_views) : vm.process_function.call(packet_accessor);
+
+    bool call_ok = (result.status() == sol::call_status::ok);
+
+    record_call(start_cycles, call_ok);
+
+    if ( unlikely(!call_ok) ) {
+        sol::error err = result;
+
+        log(LOG_INFO, "lua process call failed {}", err.what());
+    } else {
+        int verdict = result.get< int >();
+
+        record_verdict(verdict);
+
+        dst_endpoint_id = verdict_to_endpoint_id(verdict, dst_endpoint_id);
+
+        if ( eval_flow_once ) {
+            packet_accessor.flow_info->overwrite_dst_port = dst_endpoint_id;
+            packet_accessor.flow_info->verdict_epoch      = vm.epoch;
+
+            rte_wmb();
+        }
+    }
+
+    return dst_endpoint_id;
+}
+
+void lua_packet_filter::evaluate_burst(lua_filter_vm&          vm,
+                                       mbuf_vec_base&          mbuf_vec,
+                                       const flow_group_table& flow_groups,
+                                       bool                    per_group) {
+    uint16_t num_targets    = per_group ? flow_groups.size() : mbuf_vec.size();
+    uint16_t num_candidates = 0;
+
+    // Collect everything that actually needs a decision from the script
+    for ( uint16_t target_idx = 0; target_idx < num_targets; ++target_idx ) {
+        rte_mbuf* packet = per_group ? mbuf_vec.begin()[flow_groups.packet_indices(flow_groups[target_idx])[0]]
+                                     : mbuf_vec.begin()[target_idx];
+
+        lua_packet_accessor& packet_accessor = vm.burst_accessors[num_candidates];
+
+        packet_accessor.init(packet);
+
+        if ( !packet_accessor.flow_info ) {
+            continue;
+        }
+
+        uint16_t flow_dst_endpoint_id = packet_accessor.packet_info->dst_endpoint_id;
+
+        if ( lookup_flow_verdict(vm, packet_accessor, flow_dst_endpoint_id) ) {
+            if ( per_group ) {
+                apply_to_group(mbuf_vec, flow_groups, target_idx, flow_dst_endpoint_id);
+            } else {
+                packet_accessor.packet_info->dst_endpoint_id = flow_dst_endpoint_id;
+            }
+
+            continue;
+        }
+
+        if ( use_ffi ) {
+            vm.burst_views[num_candidates].init(packet);
+        }
+
+        vm.burst_targets[num_candidates++] = target_idx;
+    }
+
+    if ( !num_candidates ) {
+        return;
+    }
+
+    uint64_t start_cycles = call_timestamp();
+
+    auto result = use_ffi ? vm.process_burst_function.call(vm.ffi_views, num_candidates, vm.ffi_verdicts)
+                          : vm.process_burst_function.call(vm.burst_packets, num_candidates, vm.burst_verdicts);
+
+    bool call_ok = (result.status() == sol::call_status::ok);
+
+    record_call(start_cycles, call_ok);
+
+    if ( unlikely(!call_ok) ) {
+        sol::error err = result;
+
+        log(LOG_INFO, "lua process_burst call failed {}", err.what());
+    }
+
+    for ( uint16_t idx = 0; idx < num_candidates; ++idx ) {
+        int verdict;
+
+        // Reset in both cases so that the next burst starts with an empty verdict array
+        if ( use_ffi ) {
+            verdict = vm.burst_verdict_values[idx];
+
+            if ( verdict == PACKET_ACTION_NONE ) {
+                continue;
+            }
+
+            vm.burst_verdict_values[idx] = PACKET_ACTION_NONE;
+        } else {
+            auto verdict_opt = vm.burst_verdicts.raw_get< sol::optional< int > >(idx + 1);
+
+            if ( !verdict_opt ) {
+                continue;
+            }
+
+            vm.burst_verdicts.raw_set(idx + 1, sol::lua_nil);
+
+            verdict = *verdict_opt;
+        }
+
+        if ( unlikely(!call_ok) ) {
+            continue;
+        }
+
+        record_verdict(verdict);
+
+        lua_packet_accessor& packet_accessor = vm.burst_accessors[idx];
+
+        uint16_t dst_endpoint_id = verdict_to_endpoint_id(verdict, packet_accessor.packet_info->dst_endpoint_id);
+
+        if ( per_group ) {
+            apply_to_group(mbuf_vec, flow_groups, vm.burst_targets[idx], dst_endpoint_id);
+        } else {
+            packet_accessor.packet_info->dst_endpoint_id = dst_endpoint_id;
+        }
+
+        if ( eval_flow_once ) {
+            packet_accessor.flow_info->overwrite_dst_port = dst_endpoint_id;
+            packet_accessor.flow_info->verdict_epoch      = vm.epoch;
+        }
+    }
+
+    if ( eval_flow_once ) {
+        rte_wmb();
+    }
+}
+
+void lua_packet_filter::init_ffi(lua_filter_vm& vm) {
+    vm.lua.get().open_libraries(sol::lib::ffi, sol::lib::bit32);
+
+    vm.lua.get()["FLOW_LOCAL_STORAGE_SIZE"] = FLOW_LOCAL_STORAGE_SIZE;
+
+    // Picked up and cleared again by lua_ffi.lua
+    vm.lua.get()["__packet_read"]    = (void*) &ffi_packet_read;
+    vm.lua.get()["__packet_compare"] = (void*) &ffi_packet_compare;
+    vm.lua.get()["__packet_find"]    = (void*) &ffi_packet_find;
+
+    vm.lua.execute(std::string((const char*) ___SRC_LUA_FFI_LUA, ___SRC_LUA_FFI_LUA_LEN), "internal_ffi");
+
+    sol::protected_function offsetof_func = vm.lua.get()["__ffi_offsetof"];
+    sol::protected_function sizeof_func   = vm.lua.get()["__ffi_sizeof"];
+    sol::protected_function cast_func     = vm.lua.get()["__ffi_cast"];
+
+    if ( !offsetof_func.valid() || !sizeof_func.valid() || !cast_func.valid() ) {
+        throw std::runtime_error("could not load ffi definitions");
+    }
+
+    // Catch any divergence between the C++ types and the cdefs before a script can read garbage
+    for ( const auto& entry : ffi_layout ) {
+        sol::protected_function_result result =
+            entry.field ? offsetof_func(entry.ctype, entry.field) : sizeof_func(entry.ctype);
+
+        sol::optional< size_t > lua_value;
+
+        if ( result.valid() ) {
+            lua_value = result.get< sol::optional< size_t > >();
+        }
+
+        if ( !lua_value || lua_value.value() != entry.value ) {
+            throw std::runtime_error(fmt::format("ffi layout mismatch for {}.{}: expected {}",
+                                                 entry.ctype,
+                                                 entry.field ? entry.field : "<size>",
+                                                 entry.value));
+        }
+    }
+
+    std::fill(vm.burst_verdict_values.begin(), vm.burst_verdict_values.end(), PACKET_ACTION_NONE);
+
+    sol::protected_function_result views_result = cast_func("lua_packet_view*", (void*) vm.burst_views.data());
+    sol::protected_function_result verdicts_result =
+        cast_func("int32_t*", (void*) vm.burst_verdict_values.data());
+
+    if ( !views_result.valid() || !verdicts_result.valid() ) {
+        throw std::runtime_error("could not create ffi views");
+    }
+
+    vm.ffi_views    = views_result.get< sol::object >();
+    vm.ffi_verdicts = verdicts_result.get< sol::object >();
+
+    vm.ffi_cast_function = vm.lua.get()["__ffi_cast"];
+}
+
+void lua_packet_filter::install_trace_hook(lua_filter_vm& vm) {
+#if TELEMETRY_ENABLED == 1
+    // Trace events are raised while the vm runs, i.e. on the lcore that owns it
+    vm.lua.set_function("__trace_event", [this](std::string_view what) {
+        if ( what == "start" ) {
+            m_trace_started.inc();
+        } else if ( what == "stop" ) {
+            m_trace_compiled.inc();
+        } else if ( what == "abort" ) {
+            m_trace_aborted.inc();
+        } else if ( what == "flush" ) {
+            m_trace_flushed.inc();
+        }
+    });
+
+    vm.lua.execute(TRACE_HOOK_SCRIPT, "internal_trace_hook");
+#endif
+}
+
+void lua_packet_filter::evaluate_packets(lua_filter_vm& vm, mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) {
+    const flow_group_table& flow_groups = ctx.get_flow_groups();
+
+    bool per_group = group_by_flow && flow_groups.is_valid_for(mbuf_vec);
+
+    if ( vm.use_burst_function ) {
+        evaluate_burst(vm, mbuf_vec, flow_groups, per_group);
+
+        return;
+    }
+
+    if ( per_group ) {
+        // One decision per flow, applied to all packets of that flow within this burst
+        for ( uint16_t group_idx = 0; group_idx < flow_groups.size(); ++group_idx ) {
+            lua_packet_accessor packet_accessor;
+
+            packet_accessor.init(mbuf_vec.begin()[flow_groups.packet_indices(flow_groups[group_idx])[0]]);
+
+            apply_to_group(mbuf_vec, flow_groups, group_idx, evaluate(vm, packet_accessor));
+        }
+
+        return;
+    }
+
+    for ( auto packet : mbuf_vec ) {
+        lua_packet_accessor packet_accessor;
+
+        packet_accessor.init(packet);
+
+        if ( !packet_accessor.flow_info ) {
+            // Just ignore packets without a valid flow for now...
+            // Can be improved later™
+            continue;
+        }
+
+        packet_accessor.packet_info->dst_endpoint_id = evaluate(vm, packet_accessor);
+    }
+}
+
+void lua_packet_filter::gc_step(lua_filter_vm& vm) {
+    lua_State* L = vm.lua.get().lua_state();
+
+    uint32_t memory_kb = (uint32_t) lua_gc(L, LUA_GCCOUNT, 0);
+    uint32_t num_steps = gc_steps_per_burst;
+
+    bool boost = gc_boost_threshold_kb && (memory_kb > gc_boost_threshold_kb);
+
+    if ( unlikely(boost) ) {
+        num_steps *= GC_BOOST_STEP_FACTOR;
+    }
+
+    uint64_t start_cycles = rte_rdtsc();
+
+    uint32_t num_executed = 0;
+
+    while ( num_executed < num_steps ) {
+        ++num_executed;
+
+        // Returns 1 once a cycle is finished. Don't start the next one within the same burst
+        if ( lua_gc(L, LUA_GCSTEP, 0) ) {
+            break;
+        }
+    }
+
+    // A step re-arms the automatic collector. Stop it again so that nothing but these steps collect
+    lua_gc(L, LUA_GCSTOP, 0);
+
+#if TELEMETRY_ENABLED == 1
+    uint64_t cycles = rte_rdtsc() - start_cycles;
+
+    m_gc_steps.add(num_executed);
+    m_gc_cycles.add(cycles);
+    m_gc_memory_kb.set(memory_kb);
+
+    if ( cycles > m_gc_max_pause_cycles.get() ) {
+        m_gc_max_pause_cycles.set(cycles);
+    }
+
+    if ( unlikely(boost) ) {
+        m_gc_boost.inc();
+    }
+#else
+    (void) start_cycles;
+#endif
+}
+
+uint16_t lua_packet_filter::process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) {
+    uint32_t lcore_id = rte_lcore_id();
+
+    lua_filter_vm* vm =
+        likely(lcore_id < RTE_MAX_LCORE) ? active_vms[lcore_id].load(std::memory_order_acquire) : nullptr;
+
+    // No vm for this lcore, lcore_init was not called. Passing the packets would forward everything the filter is
+    // supposed to decide on, so the burst is dropped (counted as processor drops)
+    if ( unlikely(!vm) ) {
+        return 0;
+    }
+
+    evaluate_packets(*vm, mbuf_vec, ctx);
+
+    if ( gc_steps_per_burst ) {
+        gc_step(*vm);
+    }
+
+    return mbuf_vec.size();
+}
+
+void lua_shared_map_handle::publish(sol::table values) {
+    if ( !writable ) {
+        throw std::runtime_error(fmt::format("shared map {} can only be published from the control thread", map->name));
+    }
+
+    auto new_values = std::make_unique< lua_shared_map::snapshot >();
+
+    for ( const auto& [key, value] : values ) {
+        if ( key.get_type() != sol::type::number || value.get_type() != sol::type::number ) {
+            throw std::runtime_error(fmt::format("shared map {} only takes integer keys and number values", map->name));
+        }
+
+        new_values->emplace(key.as< uint64_t >(), value.as< double >());
+    }
+
+    filter->publish_shared_map(*map, std::move(new_values));
+}
+
+lua_shared_map& lua_packet_filter::get_shared_map(const std::string& map_name) {
+    // Any vm may ask at any time. Not vm_lock, that one is held while vms get created and run their top level code
+    std::lock_guard< std::mutex > guard(shared_map_lock);
+
+    for ( auto& map : shared_maps ) {
+        if ( map->name == map_name ) {
+            return *map;
+        }
+    }
+
+    shared_maps.push_back(std::make_unique< lua_shared_map >(map_name));
+
+    return *shared_maps.back();
+}
+
+void lua_packet_filter::publish_shared_map(lua_shared_map&                                   map,
+                                           std::unique_ptr< const lua_shared_map::snapshot > values) {
+    std::unique_ptr< const lua_shared_map::snapshot > previous = std::move(map.owned);
+
+    map.owned = std::move(values);
+
+    map.current.store(map.owned.get(), std::memory_order_release);
+
+    // No lcore can still be reading the previous snapshot after this
+    if ( previous ) {
+        flow_database_ptr->rcu_synchronize();
+    }
+}
+
+std::unique_ptr< lua_filter_vm > lua_packet_filter::create_vm(const std::string& bytecode,
+                                                                uint32_t           epoch,
+                                                                int                socket_id,
+                                                                bool               is_control) {
+    std::unique_ptr< lua_filter_vm > vm;
+
+    if ( use_lua_arena ) {
+        vm = std::make_unique< lua_filter_vm >(
+            std::make_unique< dpdk_lua_arena >(socket_id, (size_t) lua_memory_limit_kb * 1024));
+    } else {
+        vm = std::make_unique< lua_filter_vm >();
+    }
+
+    vm->epoch          = epoch;
+    vm->previous_epoch = (epoch == vm_epoch) ? previous_vm_epoch : vm_epoch;
+    vm->is_control     = is_control;
+
+    lua_engine& lua = vm->lua;
+
+    lua.load_stdlibs();
+
+    // Bindings go in first so that they are also available to the top level code and the init function of the script
+    lua.set_function("ipv4_to_str", [](uint32_t ipv4) -> std::string { return ipv4_to_str(ipv4); });
+
+    // Verdict for all members of a multicast group. Just an endpoint id, so it can be computed once and kept
+    lua.set_function("multicast", [](int group_id) -> int {
+        if ( group_id < 0 || group_id >= MAX_MULTICAST_GROUPS ) {
+            throw std::runtime_error(fmt::format("multicast group {} out of range", group_id));
+        }
+
+        return PORT_ID_MULTICAST_BASE + group_id;
+    });
+
+    lua.set("DROP", PACKET_ACTION_DROP);
+    lua.set("BROADCAST", PACKET_ACTION_BROADCAST);
+    lua.set("MAX_BURST_SIZE", (int) MAX_BURST_SIZE);
+    lua.set("IP_PROTO_ICMP", (int) IP_PROTO_ICMP);
+    lua.set("IP_PROTO_TCP", (int) IP_PROTO_TCP);
+    lua.set("IP_PROTO_UDP", (int) IP_PROTO_UDP);
+
+    lua_filter_vm* vm_ptr = vm.get();
+
+    lua.set_function("add_timer", [vm_ptr](double interval_ms, sol::function callback) {
+        if ( !(interval_ms > 0) ) {
+            throw std::runtime_error("timer interval must be positive");
+        }
+
+        uint64_t interval_cycles = (uint64_t) (interval_ms * (double) rte_get_tsc_hz() / 1000.0);
+
+        vm_ptr->timers.push_back({interval_cycles, rte_get_tsc_cycles() + interval_cycles, std::move(callback)});
+    });
+
+    lua.get().new_usertype< lua_shared_map_handle >("shared_map_handle",
+                                                    sol::no_constructor,
+                                                    "get",
+                                                    &lua_shared_map_handle::get,
+                                                    "size",
+                                                    &lua_shared_map_handle::size,
+                                                    "publish",
+                                                    &lua_shared_map_handle::publish);
+
+    // Every vm of this filter resolving the same name gets the same map
+    lua.set_function("shared_map", [this, vm_ptr](const std::string& map_name) {
+        return lua_shared_map_handle {this, &get_shared_map(map_name), vm_ptr->is_control};
+    });
+
+    lua.get().new_usertype< lua_packet_accessor >("packet",
+                                                  sol::no_constructor,
+                                                  "is_arp",
+                                                  &lua_packet_accessor::is_arp,
+                                                  "is_ipv4",
+                                                  &lua_packet_accessor::is_ipv4,
+                                                  "is_udp",
+                                                  &lua_packet_accessor::is_udp,
+                                                  "is_tcp",
+                                                  &lua_packet_accessor::is_tcp,
+                                                  "is_icmp",
+                                                  &lua_packet_accessor::is_icmp,
+                                                  "get_dst_ipv4",
+                                                  &lua_packet_accessor::get_dst_ipv4,
+                                                  "get_src_ipv4",
+                                                  &lua_packet_accessor::get_src_ipv4,
+                                                  "get_src_endpoint_id",
+                                                  &lua_packet_accessor::get_src_endpoint,
+                                                  "get_dst_endpoint_id",
+                                                  &lua_packet_accessor::get_dst_endpoint,
+                                                  "get_flow_value",
+                                                  &lua_packet_accessor::get_flow_value,
+                                                  "set_flow_value",
+                                                  &lua_packet_accessor::set_flow_value,
+                                                  "len",
+                                                  &lua_packet_accessor::get_len,
+                                                  "get_l3_offset",
+                                                  &lua_packet_accessor::get_l3_offset,
+                                                  "get_l4_offset",
+                                                  &lua_packet_accessor::get_l4_offset,
+                                                  "get_payload_offset",
+                                                  &lua_packet_accessor::get_payload_offset,
+                                                  "read_u8",
+                                                  &lua_packet_accessor::read< uint8_t >,
+                                                  "read_u16",
+                                                  &lua_packet_accessor::read< uint16_t >,
+                                                  "read_u32",
+                                                  &lua_packet_accessor::read< uint32_t >,
+                                                  "equals",
+                                                  &lua_packet_accessor::equals,
+                                                  "find",
+                                                  &lua_packet_accessor::find);
+
+    if ( !shared_config.empty() ) {
+        shared_config.publish(lua, "config");
+    }
+
+    if ( use_ffi ) {
+        init_ffi(*vm);
+    }
+
+    install_trace_hook(*vm);
+
+    lua.execute(bytecode, script_filename, sol::load_mode::binary);
+
+    auto init_func = lua.get< sol::function >("init");
+
+    if ( init_func ) {
+        init_func->call(get_name());
+    } else {
+        log(LOG_WARN, "lua packet filter script {} has no init function", script_filename);
+    }
+
+    auto proc_burst_func = lua.get< sol::function >("process_burst");
+
+    if ( proc_burst_func.has_value() ) {
+        vm->process_burst_function = proc_burst_func.value();
+
+        // In ffi mode the script works on the cdata arrays created in init_ffi instead
+        if ( !use_ffi ) {
+            vm->burst_packets  = lua.get().create_table(MAX_BURST_SIZE, 0);
+            vm->burst_verdicts = lua.get().create_table(MAX_BURST_SIZE, 0);
+
+            // The table only holds references. Updating an accessor on the C++ side is directly visible to the script.
+            for ( size_t idx = 0; idx < vm->burst_accessors.size(); ++idx ) {
+                vm->burst_packets[idx + 1] = &vm->burst_accessors[idx];
+            }
+        }
+    }
+
+    vm->use_burst_function = vm->process_burst_function.valid();
+
+    auto proc_func = lua.get< sol::function >("process");
+
+    if ( proc_func.has_value() ) {
+        vm->process_function = proc_func.value();
+    }
+
+    auto new_flow_func = lua.get< sol::function >("on_new_flow");
+
+    if ( new_flow_func.has_value() ) {
+        vm->new_flow_function = new_flow_func.value();
+    }
+
+    auto flow_expire_func = lua.get< sol::function >("on_flow_expire");
+
+    if ( flow_expire_func.has_value() ) {
+        vm->flow_expire_function = flow_expire_func.value();
+    }
+
+    if ( !vm->process_function.valid() && !vm->use_burst_function && !vm->new_flow_function.valid() &&
+         vm->timers.empty() ) {
+        throw std::runtime_error(fmt::format(
+            "{} does neither expose a process, a process_burst nor an on_new_flow function nor adds a timer",
+            script_filename));
+    }
+
+    lua.execute(GC_GUARD_SCRIPT, "internal_gc_guard");
+
+    // Still off the datapath here. Start with a clean heap and leave collecting to gc_step from now on
+    lua_State* L = lua.get().lua_state();
+
+    lua_gc(L, LUA_GCCOLLECT, 0);
+
+    if ( gc_steps_per_burst ) {
+        lua_gc(L, LUA_GCSTOP, 0);
+    }
+
+    return vm;
+}
+
+void lua_packet_filter::init(const flow_proc_builder& builder) {
+
+    auto lua_script_filename = builder.get_param("script_filename");
+
+    if ( !lua_script_filename.has_value() ) {
+        throw std::runtime_error("script_filename not set");
+    }
+
+    script_filename = lua_script_filename.value();
+
+    auto use_ffi_opt = builder.get_param("use_ffi");
+
+    if ( use_ffi_opt.has_value() ) {
+        use_ffi = (use_ffi_opt.value() == "true");
+    }
+
+    static const std::string config_prefix = "config.";
+
+    for ( const auto& [key, value] : builder.get_params() ) {
+        if ( key.compare(0, config_prefix.size(), config_prefix) == 0 ) {
+            shared_config.set_from_string(key.substr(config_prefix.size()), value);
+        }
+    }
+
+    auto gc_steps_opt = builder.get_param("gc_steps_per_burst");
+
+    if ( gc_steps_opt.has_value() ) {
+        gc_steps_per_burst = (uint32_t) std::stoul(gc_steps_opt.value());
+    }
+
+    auto gc_boost_opt = builder.get_param("gc_boost_threshold_kb");
+
+    if ( gc_boost_opt.has_value() ) {
+        gc_boost_threshold_kb = (uint32_t) std::stoul(gc_boost_opt.value());
+    }
+
+    auto lua_arena_opt = builder.get_param("lua_arena");
+
+    if ( lua_arena_opt.has_value() ) {
+        use_lua_arena = (lua_arena_opt.value() == "true");
+    }
+
+    auto lua_limit_opt = builder.get_param("lua_memory_limit_kb");
+
+    if ( lua_limit_opt.has_value() ) {
+        lua_memory_limit_kb = (uint32_t) std::stoul(lua_limit_opt.value());
+    }
+
+    // Every filter instance running the same script shares the bytecode of the first one
+    script_bytecode =
+        lua_bytecode_cache::instance().get_or_compile(load_file_as_string(script_filename), script_filename);
+
+    initial_vm = create_vm(*script_bytecode, vm_epoch, SOCKET_ID_ANY);
+
+    if ( initial_vm->use_burst_function ) {
+        log(LOG_INFO, "lua packet filter {} uses process_burst", get_name());
+    }
+
+    if ( use_lua_arena && !initial_vm->lua.has_custom_allocator() ) {
+        log(LOG_WARN,
+            "lua packet filter {} can not place its vms in hugepage memory, lua_memory_limit_kb is not enforced",
+            get_name());
+
+        use_lua_arena = false;
+    }
+
+    auto eval_flow_once_opt = builder.get_param("eval_flow_once");
+
+    if(eval_flow_once_opt.has_value()) {
+        eval_flow_once = (eval_flow_once_opt.value() == "true");
+    }
+
+    auto group_by_flow_opt = builder.get_param("group_by_flow");
+
+    if ( group_by_flow_opt.has_value() ) {
+        group_by_flow = (group_by_flow_opt.value() == "true");
+    }
+
+    auto defer_new_flows_opt = builder.get_param("defer_new_flows");
+
+    if ( defer_new_flows_opt.has_value() ) {
+        defer_new_flows = (defer_new_flows_opt.value() == "true");
+    }
+
+    auto new_flow_verdict_opt = builder.get_param("new_flow_verdict");
+
+    if ( new_flow_verdict_opt.has_value() ) {
+        new_flow_verdict = parse_verdict(new_flow_verdict_opt.value());
+    }
+
+    if ( defer_new_flows ) {
+        if ( !initial_vm->new_flow_function.valid() ) {
+            log(LOG_WARN, "lua packet filter {} defers new flows but {} has no on_new_flow", get_name(), script_filename);
+        }
+
+        std::string ring_name = fmt::format("lua_new_flows_{}", new_flow_ring_counter++);
+
+        new_flow_ring = std::unique_ptr< rte_ring, dpdk_ring_deleter >(rte_ring_create_elem(
+            ring_name.c_str(), sizeof(new_flow_request), FLOW_EVENT_RING_SIZE, SOCKET_ID_ANY, RING_F_SC_DEQ));
+
+        if ( !new_flow_ring ) {
+            throw std::runtime_error(fmt::format("could not create new flow ring: {}", rte_strerror(rte_errno)));
+        }
+    }
+
+    if ( initial_vm->flow_expire_function.valid() ) {
+        flow_expire_ring = flow_database_ptr->subscribe_expired_flows(FLOW_EVENT_RING_SIZE);
+    }
+
+    if ( new_flow_ring || flow_expire_ring || !initial_vm->timers.empty() ) {
+        control_vm = create_vm(*script_bytecode, vm_epoch, SOCKET_ID_ANY, true);
+    }
+
+    auto watch_script_opt = builder.get_param("watch_script");
+
+    if ( watch_script_opt.has_value() && watch_script_opt.value() == "true" ) {
+        script_watcher = std::make_unique< filesystem_watcher >();
+
+        script_watcher->add_watch(filesystem_watch(script_filename));
+
+        log(LOG_INFO, "lua packet filter {} watches {} for changes", get_name(), script_filename);
+    }
+}
+
+lua_packet_filter::~lua_packet_filter() {
+    if ( flow_expire_ring ) {
+        flow_database_ptr->unsubscribe_expired_flows(flow_expire_ring);
+    }
+}
+
+void lua_packet_filter::lcore_init(uint32_t lcore_id) {
+    std::lock_guard< std::mutex > guard(vm_lock);
+
+    if ( lcore_vms[lcore_id] ) {
+        return;
+    }
+
+    if ( initial_vm && !use_lua_arena ) {
+        lcore_vms[lcore_id] = std::move(initial_vm);
+    } else {
+        // The initial vm is not on the right socket anyway. No need to keep it around
+        initial_vm.reset();
+
+        // Every further lcore gets its own replica running the same bytecode
+        try {
+            lcore_vms[lcore_id] = create_vm(*script_bytecode, vm_epoch, (int) rte_lcore_to_socket_id(lcore_id));
+
+            log(LOG_INFO, "lua packet filter {} created vm replica for lcore {}", get_name(), lcore_id);
+        } catch ( const std::exception& e ) {
+            throw std::runtime_error(fmt::format(
+                "lua packet filter {} could not create vm for lcore {}: {}", get_name(), lcore_id, e.what()));
+        }
+    }
+
+    active_vms[lcore_id].store(lcore_vms[lcore_id].get(), std::memory_order_release);
+}
+
+#if TELEMETRY_ENABLED == 1
+void lua_packet_filter::init_telemetry(telemetry_distributor& telemetry) {
+    telemetry.add_metric(filter_metric_grp);
+}
+#endif
+
+void lua_packet_filter::control_poll() {
+    if ( script_watcher && !script_watcher->poll_changes().empty() ) {
+        reload_script();
+    }
+
+    if ( !control_vm ) {
+        return;
+    }
+
+    if ( new_flow_ring ) {
+        poll_new_flows();
+    }
+
+    if ( flow_expire_ring ) {
+        poll_expired_flows();
+    }
+
+    if ( !control_vm->timers.empty() ) {
+        run_timers();
+    }
+
+    if ( gc_steps_per_burst ) {
+        gc_step(*control_vm);
+    }
+}
+
+void lua_packet_filter::poll_new_flows() {
+    lua_filter_vm& vm = *control_vm;
+
+    std::array< new_flow_request, MAX_BURST_SIZE > requests;
+
+    size_t num_handled = 0;
+
+    while ( num_handled < MAX_FLOW_EVENTS_PER_POLL ) {
+        unsigned int num_requests = rte_ring_sc_dequeue_burst_elem(
+            new_flow_ring.get(), requests.data(), sizeof(new_flow_request), requests.size(), nullptr);
+
+        if ( !num_requests ) {
+            break;
+        }
+
+        num_handled += num_requests;
+
+        for ( unsigned int idx = 0; idx < num_requests; ++idx ) {
+            flow_info_ipv4* flow_info = requests[idx].flow_info;
+
+            // The entry got recycled for another flow in the meantime
+            if ( flow_info->flow_hash != requests[idx].hash ) {
+                continue;
+            }
+
+            int verdict = PACKET_ACTION_NONE;
+
+            if ( vm.new_flow_function.valid() ) {
+                // No flow local storage here. The datapath may be using it at the same time
+                auto result = vm.new_flow_function.call(create_flow_table(vm, *flow_info, nullptr));
+
+                if ( result.status() != sol::call_status::ok ) {
+                    sol::error err = result;
+
+                    log(LOG_INFO, "lua on_new_flow call failed {}", err.what());
+                } else {
+                    verdict = result.get< sol::optional< int > >().value_or(PACKET_ACTION_NONE);
+                }
+            }
+
+            // The entry may have been recycled while the script was deciding. The verdict belongs to the old flow
+            if ( unlikely(flow_info->flow_hash != requests[idx].hash) ) {
+                continue;
+            }
+
+            flow_info->overwrite_dst_port = verdict_to_endpoint_id(verdict, PORT_ID_IGNORE);
+            rte_smp_wmb();
+            flow_info->verdict_epoch = vm.epoch;
+
+            // Recycled between the check and the write. Don't leave the verdict on somebody else's flow
+            if ( unlikely(flow_info->flow_hash != requests[idx].hash) ) {
+                flow_info->verdict_epoch = 0;
+            }
+        }
+    }
+}
+
+void lua_packet_filter::poll_expired_flows() {
+    lua_filter_vm& vm = *control_vm;
+
+    static constexpr unsigned int EXPIRE_BURST_SIZE = 32;
+
+    std::array< flow_expire_event, EXPIRE_BURST_SIZE > events;
+
+    double tsc_hz = (double) rte_get_tsc_hz();
+
+#if TELEMETRY_ENABLED == 1
+    m_flow_expire_events_lost.set(flow_database_ptr->get_num_lost_expire_events(flow_expire_ring));
+#endif
+
+    size_t num_handled = 0;
+
+    while ( num_handled < MAX_FLOW_EVENTS_PER_POLL ) {
+        unsigned int num_events = rte_ring_sc_dequeue_burst_elem(
+            flow_expire_ring, events.data(), sizeof(flow_expire_event), events.size(), nullptr);
+
+        if ( !num_events ) {
+            break;
+        }
+
+        num_handled += num_events;
+
+#if TELEMETRY_ENABLED == 1
+        m_flows_expired.add(num_events);
+#endif
+
+        // The script may have been reloaded without on_flow_expire. Drain anyway
+        if ( !vm.flow_expire_function.valid() ) {
+            continue;
+        }
+
+        uint64_t now = rte_get_tsc_cycles();
+
+        for ( unsigned int idx = 0; idx < num_events; ++idx ) {
+            const flow_info_ipv4& info = events[idx].info;
+
+            sol::table stats = vm.lua.get().create_table(0, 4);
+
+            stats["packets"]  = info.packets;
+            stats["bytes"]    = info.bytes;
+            stats["duration"] = (double) (info.last_used - info.first_seen) / tsc_hz;
+            stats["idle"]     = (double) (now - info.last_used) / tsc_hz;
+
+            auto result = vm.flow_expire_function.call(create_flow_table(vm, info, events[idx].storage), stats);
+
+            if ( result.status() != sol::call_status::ok ) {
+                sol::error err = result;
+
+                log(LOG_INFO, "lua on_flow_expire call failed {}", err.what());
+            }
+        }
+    }
+}
+
+void lua_packet_filter::run_timers() {
+    uint64_t now = rte_get_tsc_cycles();
+
+    // By index, a callback may add further timers
+    for ( size_t idx = 0; idx < control_vm->timers.size(); ++idx ) {
+        lua_timer& timer = control_vm->timers[idx];
+
+        if ( now < timer.next_run ) {
+            continue;
+        }
+
+        // A timer that fell behind skips the missed runs instead of catching up
+        timer.next_run = now + timer.interval_cycles;
+
+        sol::function callback = timer.callback;
+
+        auto result = callback.call();
+
+        if ( result.status() != sol::call_status::ok ) {
+            sol::error err = result;
+
+            log(LOG_INFO, "lua timer call failed {}", err.what());
+        }
+    }
+}
+
+void lua_packet_filter::reload_script() {
+    std::lock_guard< std::mutex > guard(vm_lock);
+
+    uint32_t new_epoch = next_vm_epoch();
+
+    lua_bytecode_cache::bytecode_ptr                               new_bytecode;
+    std::array< std::unique_ptr< lua_filter_vm >, RTE_MAX_LCORE > new_vms;
+    std::unique_ptr< lua_filter_vm >                               new_control_vm;
+
+    // Everything that can fail happens before the first vm gets replaced. On error the old script just keeps running.
+    try {
+        new_bytecode =
+            lua_bytecode_cache::instance().get_or_compile(load_file_as_string(script_filename), script_filename);
+
+        for ( size_t lcore_id = 0; lcore_id < lcore_vms.size(); ++lcore_id ) {
+            if ( lcore_vms[lcore_id] ) {
+                new_vms[lcore_id] = create_vm(*new_bytecode, new_epoch, (int) rte_lcore_to_socket_id(lcore_id));
+            }
+        }
+
+        if ( initial_vm ) {
+            initial_vm = create_vm(*new_bytecode, new_epoch, SOCKET_ID_ANY);
+        }
+
+        bool has_timers      = initial_vm && !initial_vm->timers.empty();
+        bool has_flow_expire = initial_vm && initial_vm->flow_expire_function.valid();
+
+        for ( const auto& vm : new_vms ) {
+            has_timers      = has_timers || (vm && !vm->timers.empty());
+            has_flow_expire = has_flow_expire || (vm && vm->flow_expire_function.valid());
+        }
+
+        if ( control_vm || has_timers || has_flow_expire ) {
+            new_control_vm = create_vm(*new_bytecode, new_epoch, SOCKET_ID_ANY, true);
+        }
+
+        // A script that got on_flow_expire with this reload starts getting events from now on
+        if ( has_flow_expire && !flow_expire_ring ) {
+            flow_expire_ring = flow_database_ptr->subscribe_expired_flows(FLOW_EVENT_RING_SIZE);
+        }
+    } catch ( const std::exception& e ) {
+        log(LOG_ERROR, "lua packet filter {} could not reload {}: {}", get_name(), script_filename, e.what());
+
+        return;
+    }
+
+    for ( size_t lcore_id = 0; lcore_id < lcore_vms.size(); ++lcore_id ) {
+        if ( new_vms[lcore_id] ) {
+            active_vms[lcore_id].store(new_vms[lcore_id].get(), std::memory_order_release);
+        }
+    }
+
+    // No lcore can still be inside one of the old vms after this
+    flow_database_ptr->rcu_synchronize();
+
+    for ( size_t lcore_id = 0; lcore_id < lcore_vms.size(); ++lcore_id ) {
+        if ( new_vms[lcore_id] ) {
+            lcore_vms[lcore_id] = std::move(new_vms[lcore_id]);
+        }
+    }
+
+    // Only ever used from the control thread, which is this one
+    if ( new_control_vm ) {
+        control_vm = std::move(new_control_vm);
+    }
+
+    script_bytecode   = std::move(new_bytecode);
+    previous_vm_epoch = vm_epoch;
+    vm_epoch          = new_epoch;
+
+    log(LOG_INFO, "lua packet filter {} reloaded {} (epoch {})", get_name(), script_filename, vm_epoch);
+}
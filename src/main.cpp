@@ -29,6 +29,7 @@
 #include <flow_base.hpp>
 #include <flow_config.hpp>
 #include <flow_manager.hpp>
+#include <drop_stats.hpp>
 
 #include <app_config.hpp>
 #include <string_view>
@@ -92,6 +93,10 @@ private:
 
     void load_flow_proc();
 
+    void reload_flow_proc();
+
+    void log_drop_samples();
+
 
     std::unique_ptr< flow_endpoint_base > create_endpoint(const std::string& type,
                                                           const std::string& id,
@@ -105,6 +110,8 @@ private:
 
     std::vector< std::string > device_names;
 
+    uint32_t drop_sample_interval;
+
     uint32_t pool_size;
     uint16_t cache_size;
     uint16_t dataroom_size;
@@ -170,6 +177,9 @@ int main(int argc, char** argv) {
         rc = -1;
     }
 
+    // Owns a ring, can't wait for static destruction
+    packet_drop_stats.disable_sampling();
+
     rte_eal_cleanup();
 
     return rc;
@@ -177,6 +187,7 @@ int main(int argc, char** argv) {
 
 flow_orchestrator_app::flow_orchestrator_app(int argc, char** argv) :
     should_exit(false),
+    drop_sample_interval(0),
     pool_size(0),
     cache_size(0),
     dataroom_size(0),
@@ -200,12 +211,18 @@ int flow_orchestrator_app::run() {
 
     using namespace std::chrono_literals;
 
-    std::chrono::milliseconds wait_interval = 200ms;
+    // Processors do their control work on this period, independent of how often telemetry is reported. Deferred lua
+    // new flow decisions wait for it
+    const std::chrono::milliseconds control_interval = 10ms;
+
+    std::chrono::milliseconds report_interval = 200ms;
 
 #if TELEMETRY_ENABLED == 1
-    wait_interval = telemetry_poll_interval;
+    report_interval = telemetry_poll_interval;
 #endif
 
+    auto next_report = std::chrono::steady_clock::now() + report_interval;
+
     bool run_state = true;
 
     //    lcore_thread main_lcore_task(main_lcore.get_lcore_id(), [this, &run_state](){
@@ -221,12 +238,26 @@ int flow_orchestrator_app::run() {
     while ( run_state ) {
         int signal_num;
 
-        if ( wait_for_signal(signal_num, wait_interval) ) {
+        if ( wait_for_signal(signal_num, control_interval) ) {
             if ( signal_num == SIGINT || signal_num == SIGTERM ) {
                 run_state = false;
+            } else if ( signal_num == SIGUSR1 ) {
+                reload_flow_proc();
             }
         }
 
+        flow_mgr.poll_control();
+
+        auto now = std::chrono::steady_clock::now();
+
+        if ( now < next_report ) {
+            continue;
+        }
+
+        next_report = now + report_interval;
+
+        log_drop_samples();
+
 #if TELEMETRY_ENABLED == 1
         telemetry->do_update();
 #endif
@@ -240,14 +271,49 @@ int flow_orchestrator_app::run() {
 
     rte_eal_mp_wait_lcore();
 
+    log_drop_samples();
+
     return 0;
 }
 
+void flow_orchestrator_app::log_drop_samples() {
+    static constexpr size_t MAX_SAMPLES_PER_POLL = 16;
+
+    std::array< drop_sample, MAX_SAMPLES_PER_POLL > samples;
+
+    size_t num_samples = packet_drop_stats.read_samples(samples.data(), samples.size());
+
+    for ( size_t idx = 0; idx < num_samples; ++idx ) {
+        const drop_sample& s = samples[idx];
+
+        std::string header_str;
+
+        header_str.reserve(s.header_len * 2);
+
+        for ( uint16_t byte_idx = 0; byte_idx < s.header_len; ++byte_idx ) {
+            header_str += fmt::format("{:02x}", s.header[byte_idx]);
+        }
+
+        log(LOG_INFO,
+            "dropped packet: reason {}, lcore {}, endpoint {} -> {}, len {}, header {}",
+            get_drop_reason_name(s.reason),
+            s.lcore_id,
+            s.src_endpoint_id,
+            s.dst_endpoint_id,
+            s.pkt_len,
+            header_str);
+    }
+}
+
 static const std::string_view DPDK_OPTIONS_FLAG = "dpdk-options";
 static const std::string_view DEVICES_FLAG      = "devices";
 static const std::string_view INIT_SCRIPT_FLAG  = "init-script";
 static const std::string_view CONFIG_FILE_FLAG  = "config-file";
 
+static const std::string_view DROP_SAMPLE_INTERVAL_FLAG = "drop-sample-interval";
+
+static const uint32_t DROP_SAMPLE_RING_SIZE = 1024;
+
 static const size_t DEFAULT_FLOW_TABLE_SIZE = (1 << 14);
 
 #if TELEMETRY_ENABLED == 1
@@ -269,7 +335,10 @@ void flow_orchestrator_app::parse_args(int argc, char** argv) {
         DPDK_OPTIONS_FLAG.data(), po::value< std::vector< std::string > >()->multitoken(), "dpdk options")(
         DEVICES_FLAG.data(), po::value< std::vector< std::string > >()->multitoken(), "Devices to use")(
         INIT_SCRIPT_FLAG.data(), po::value< std::string >(), "Init script to load")(
-        CONFIG_FILE_FLAG.data(), po::value< std::string >(), "Config file to load");
+        CONFIG_FILE_FLAG.data(), po::value< std::string >(), "Config file to load")(
+        DROP_SAMPLE_INTERVAL_FLAG.data(),
+        po::value< uint32_t >(&drop_sample_interval),
+        "Log the headers of every n-th dropped packet per lcore. 0 disables sampling");
 
 #if TELEMETRY_ENABLED == 1
     uint32_t telemetry_interval_arg = DEFAULT_TELEMETRY_POLL_INTERVAL;
@@ -403,6 +472,8 @@ void flow_orchestrator_app::setup() {
 
     init_lcores();
 
+    packet_drop_stats.enable_sampling(drop_sample_interval, DROP_SAMPLE_RING_SIZE);
+
     log(LOG_INFO,
         "Creating packet memory pool: Capacity: {}, Cache Size: {}, Dataroom Size: {}, Private Size: {}",
         pool_size,
@@ -456,6 +527,8 @@ void flow_orchestrator_app::load_flow_proc() {
 
         auto flow_program = init_handler.build_program(std::move(endpoints), fdatabase);
 
+        flow_mgr.set_default_burst_limits(config.get_burst_limits());
+
         flow_mgr.load(std::move(flow_program));
 
 #if TELEMETRY_ENABLED == 1
@@ -464,6 +537,27 @@ void flow_orchestrator_app::load_flow_proc() {
     }
 }
 
+void flow_orchestrator_app::reload_flow_proc() {
+    if ( init_script_name.empty() ) {
+        return;
+    }
+
+    log(LOG_INFO, "Reloading flow init script {}", init_script_name);
+
+    // The running chains stay in place if anything goes wrong here
+    try {
+        init_script_handler init_handler;
+
+        init_handler.load_init_script(init_script_name);
+
+        auto flow_program = init_handler.build_program(flow_mgr.get_endpoints(), flow_mgr.get_flow_database());
+
+        flow_mgr.reload(std::move(flow_program));
+    } catch ( const std::exception& e ) {
+        log(LOG_ERROR, "Could not reload {}: {}", init_script_name, e.what());
+    }
+}
+
 std::unique_ptr< flow_endpoint_base > flow_orchestrator_app::create_endpoint(const std::string& type,
                                                                              const std::string& id,
                                                                              const std::string& options) {
@@ -477,6 +571,8 @@ std::unique_ptr< flow_endpoint_base > flow_orchestrator_app::create_endpoint(con
         offload_flags |= RTE_ETH_TX_OFFLOAD_UDP_CKSUM;
         offload_flags |= RTE_ETH_TX_OFFLOAD_TCP_CKSUM;
 
+        // No RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE: broadcast and multicast packets are sent with a reference per port
+
         const auto all_devices = get_available_ethdev_ids();
 
         auto dev_it = std::find_if(all_devices.begin(), all_devices.end(), [&id](uint64_t port_id) {
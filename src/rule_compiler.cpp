@@ -0,0 +1,397 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#include <rule_compiler.hpp>
+
+#include <cstddef>
+#include <sstream>
+
+#if HAS_ASMJIT == 1 && defined(__x86_64__)
+#include <asmjit/x86.h>
+
+#define RULE_JIT_ENABLED 1
+#else
+#define RULE_JIT_ENABLED 0
+#endif
+
+
+static uint32_t parse_uint(const std::string& str, uint32_t max_value, size_t line) {
+    char*         end   = nullptr;
+    unsigned long value = std::strtoul(str.c_str(), &end, 0);
+
+    if ( str.empty() || end != (str.c_str() + str.size()) || value > max_value ) {
+        throw std::runtime_error(fmt::format("rule line {}: invalid value '{}'", line, str));
+    }
+
+    return (uint32_t) value;
+}
+
+static rule_prefix_match parse_prefix(const std::string& str, size_t line) {
+    auto slash_pos = str.find('/');
+
+    std::string addr_str = str.substr(0, slash_pos);
+
+    unsigned int a, b, c, d;
+    int          num_consumed = 0;
+
+    if ( std::sscanf(addr_str.c_str(), "%u.%u.%u.%u%n", &a, &b, &c, &d, &num_consumed) != 4 ||
+         (size_t) num_consumed != addr_str.size() || a > 255 || b > 255 || c > 255 || d > 255 ) {
+        throw std::runtime_error(fmt::format("rule line {}: invalid address '{}'", line, str));
+    }
+
+    uint32_t len = (slash_pos == std::string::npos) ? 32 : parse_uint(str.substr(slash_pos + 1), 32, line);
+
+    uint32_t mask = len ? (0xffffffffU << (32 - len)) : 0;
+
+    return {((a << 24) | (b << 16) | (c << 8) | d) & mask, mask};
+}
+
+static rule_range_match parse_range(const std::string& str, size_t line) {
+    auto dash_pos = str.find('-');
+
+    if ( dash_pos == std::string::npos ) {
+        auto port = (uint16_t) parse_uint(str, 0xffff, line);
+
+        return {port, port};
+    }
+
+    auto first = (uint16_t) parse_uint(str.substr(0, dash_pos), 0xffff, line);
+    auto last  = (uint16_t) parse_uint(str.substr(dash_pos + 1), 0xffff, line);
+
+    if ( first > last ) {
+        throw std::runtime_error(fmt::format("rule line {}: invalid port range '{}'", line, str));
+    }
+
+    return {first, last};
+}
+
+static uint8_t parse_proto(const std::string& str, size_t line) {
+    if ( str == "tcp" ) {
+        return IP_PROTO_TCP;
+    } else if ( str == "udp" ) {
+        return IP_PROTO_UDP;
+    } else if ( str == "icmp" ) {
+        return IP_PROTO_ICMP;
+    }
+
+    return (uint8_t) parse_uint(str, 0xff, line);
+}
+
+std::vector< match_rule > parse_rules(const std::string& source) {
+    std::vector< match_rule > rules;
+
+    std::istringstream source_stream(source);
+    std::string        line_str;
+    size_t             line = 0;
+
+    while ( std::getline(source_stream, line_str) ) {
+        ++line;
+
+        auto comment_pos = line_str.find('#');
+
+        if ( comment_pos != std::string::npos ) {
+            line_str.resize(comment_pos);
+        }
+
+        std::istringstream       line_stream(line_str);
+        std::vector< std::string > tokens;
+        std::string              token;
+
+        while ( line_stream >> token ) {
+            tokens.push_back(std::move(token));
+        }
+
+        if ( tokens.empty() ) {
+            continue;
+        }
+
+        auto arrow_it = std::find(tokens.begin(), tokens.end(), "->");
+
+        if ( arrow_it == tokens.end() || (arrow_it + 1) == tokens.end() ) {
+            throw std::runtime_error(fmt::format("rule line {}: missing action", line));
+        }
+
+        match_rule rule {};
+
+        rule.line = line;
+
+        for ( auto it = tokens.begin(); it != arrow_it; ++it ) {
+            const std::string& field = *it;
+
+            if ( field == "any" ) {
+                continue;
+            }
+
+            if ( (it + 1) == arrow_it ) {
+                throw std::runtime_error(fmt::format("rule line {}: missing value for '{}'", line, field));
+            }
+
+            const std::string& value = *(++it);
+
+            if ( field == "src_ip" ) {
+                rule.src_addr = parse_prefix(value, line);
+            } else if ( field == "dst_ip" ) {
+                rule.dst_addr = parse_prefix(value, line);
+            } else if ( field == "src_port" ) {
+                rule.src_port = parse_range(value, line);
+            } else if ( field == "dst_port" ) {
+                rule.dst_port = parse_range(value, line);
+            } else if ( field == "proto" ) {
+                rule.proto = parse_proto(value, line);
+            } else if ( field == "vlan" ) {
+                rule.vlan = (uint16_t) parse_uint(value, 0x0fff, line);
+            } else if ( field == "src_endpoint" ) {
+                rule.src_endpoint_id = (uint16_t) parse_uint(value, 0xffff, line);
+            } else {
+                throw std::runtime_error(fmt::format("rule line {}: unknown match '{}'", line, field));
+            }
+        }
+
+        const std::string& action = *(arrow_it + 1);
+
+        size_t num_action_args = tokens.end() - (arrow_it + 2);
+
+        if ( action == "drop" || action == "broadcast" || action == "pass" ) {
+            rule.action = (action == "drop")        ? rule_action_type::DROP
+                          : (action == "broadcast") ? rule_action_type::BROADCAST
+                                                    : rule_action_type::PASS;
+
+            if ( num_action_args != 0 ) {
+                throw std::runtime_error(fmt::format("rule line {}: {} takes no argument", line, action));
+            }
+        } else if ( action == "forward" || action == "multicast" || action == "mark" ) {
+            if ( num_action_args != 1 ) {
+                throw std::runtime_error(fmt::format("rule line {}: {} takes exactly one argument", line, action));
+            }
+
+            if ( action == "forward" ) {
+                // Everything from PORT_ID_DROP upwards is reserved for drop, multicast and broadcast
+                rule.action     = rule_action_type::FORWARD;
+                rule.action_arg = (uint16_t) parse_uint(*(arrow_it + 2), PORT_ID_DROP - 1, line);
+            } else if ( action == "multicast" ) {
+                rule.action     = rule_action_type::MULTICAST;
+                rule.action_arg = (uint16_t) parse_uint(*(arrow_it + 2), MAX_MULTICAST_GROUPS - 1, line);
+            } else {
+                rule.action     = rule_action_type::MARK;
+                rule.action_arg = (uint16_t) parse_uint(*(arrow_it + 2), 63, line);
+            }
+        } else {
+            throw std::runtime_error(fmt::format("rule line {}: unknown action '{}'", line, action));
+        }
+
+        rules.push_back(rule);
+    }
+
+    return rules;
+}
+
+
+static __inline uint16_t get_rule_dst_endpoint(const match_rule& rule) {
+    switch ( rule.action ) {
+        case rule_action_type::DROP:
+            return PORT_ID_DROP;
+        case rule_action_type::BROADCAST:
+            return PORT_ID_BROADCAST;
+        case rule_action_type::FORWARD:
+            return rule.action_arg;
+        case rule_action_type::MULTICAST:
+            return PORT_ID_MULTICAST_BASE + rule.action_arg;
+        default:
+            return PORT_ID_IGNORE;
+    }
+}
+
+bool match_rule::matches(const rule_match_key& key) const noexcept {
+    if ( needs_ipv4() && !key.is_ipv4 ) {
+        return false;
+    }
+
+    if ( src_addr && (key.src_addr & src_addr->mask) != src_addr->addr ) {
+        return false;
+    }
+
+    if ( dst_addr && (key.dst_addr & dst_addr->mask) != dst_addr->addr ) {
+        return false;
+    }
+
+    if ( src_port && (key.src_port < src_port->first || key.src_port > src_port->last) ) {
+        return false;
+    }
+
+    if ( dst_port && (key.dst_port < dst_port->first || key.dst_port > dst_port->last) ) {
+        return false;
+    }
+
+    if ( proto && key.proto != *proto ) {
+        return false;
+    }
+
+    if ( vlan && key.vlan != *vlan ) {
+        return false;
+    }
+
+    if ( src_endpoint_id && key.src_endpoint_id != *src_endpoint_id ) {
+        return false;
+    }
+
+    return true;
+}
+
+
+#if RULE_JIT_ENABLED == 1
+struct compiled_rule_set::jit_data
+{
+    asmjit::JitRuntime runtime;
+};
+#else
+struct compiled_rule_set::jit_data
+{};
+#endif
+
+compiled_rule_set::compiled_rule_set(std::vector< match_rule > rules, bool allow_jit) :
+    rules(std::move(rules)), func(nullptr) {
+
+    if ( allow_jit ) {
+        compile();
+    }
+}
+
+compiled_rule_set::~compiled_rule_set() {
+#if RULE_JIT_ENABLED == 1
+    if ( func ) {
+        jit->runtime.release(func);
+    }
+#endif
+}
+
+void compiled_rule_set::interpret(const rule_match_key& key, rule_verdict& verdict) const noexcept {
+    for ( const auto& rule : rules ) {
+        if ( !rule.matches(key) ) {
+            continue;
+        }
+
+        if ( !rule.is_terminal() ) {
+            verdict.mark_bits |= (1ULL << rule.action_arg);
+
+            continue;
+        }
+
+        verdict.dst_endpoint_id = get_rule_dst_endpoint(rule);
+
+        return;
+    }
+}
+
+#if RULE_JIT_ENABLED == 1
+bool compiled_rule_set::compile() {
+    using namespace asmjit;
+
+    jit = std::make_unique< jit_data >();
+
+    CodeHolder code;
+
+    code.init(jit->runtime.environment());
+
+    x86::Assembler a(&code);
+
+    // SysV calling convention: rdi = key, rsi = verdict
+    const x86::Gp key     = x86::rdi;
+    const x86::Gp verdict = x86::rsi;
+
+    for ( const auto& rule : rules ) {
+        Label next_rule = a.newLabel();
+
+        if ( rule.needs_ipv4() ) {
+            a.cmp(x86::byte_ptr(key, offsetof(rule_match_key, is_ipv4)), 0);
+            a.je(next_rule);
+        }
+
+        auto emit_prefix = [&](const std::optional< rule_prefix_match >& prefix, size_t offset) {
+            // A /0 prefix matches everything
+            if ( !prefix || !prefix->mask ) {
+                return;
+            }
+
+            a.mov(x86::eax, x86::dword_ptr(key, offset));
+
+            if ( prefix->mask != 0xffffffffU ) {
+                a.and_(x86::eax, Imm((int32_t) prefix->mask));
+            }
+
+            a.cmp(x86::eax, Imm((int32_t) prefix->addr));
+            a.jne(next_rule);
+        };
+
+        auto emit_range = [&](const std::optional< rule_range_match >& range, size_t offset) {
+            if ( !range ) {
+                return;
+            }
+
+            a.movzx(x86::eax, x86::word_ptr(key, offset));
+
+            if ( range->first == range->last ) {
+                a.cmp(x86::eax, range->first);
+                a.jne(next_rule);
+            } else {
+                a.cmp(x86::eax, range->first);
+                a.jb(next_rule);
+                a.cmp(x86::eax, range->last);
+                a.ja(next_rule);
+            }
+        };
+
+        emit_prefix(rule.src_addr, offsetof(rule_match_key, src_addr));
+        emit_prefix(rule.dst_addr, offsetof(rule_match_key, dst_addr));
+
+        emit_range(rule.src_port, offsetof(rule_match_key, src_port));
+        emit_range(rule.dst_port, offsetof(rule_match_key, dst_port));
+
+        if ( rule.proto ) {
+            a.cmp(x86::byte_ptr(key, offsetof(rule_match_key, proto)), *rule.proto);
+            a.jne(next_rule);
+        }
+
+        if ( rule.vlan ) {
+            a.cmp(x86::word_ptr(key, offsetof(rule_match_key, vlan)), *rule.vlan);
+            a.jne(next_rule);
+        }
+
+        if ( rule.src_endpoint_id ) {
+            a.cmp(x86::word_ptr(key, offsetof(rule_match_key, src_endpoint_id)), *rule.src_endpoint_id);
+            a.jne(next_rule);
+        }
+
+        if ( rule.is_terminal() ) {
+            a.mov(x86::word_ptr(verdict, offsetof(rule_verdict, dst_endpoint_id)), get_rule_dst_endpoint(rule));
+            a.ret();
+        } else {
+            a.mov(x86::rax, Imm((int64_t) (1ULL << rule.action_arg)));
+            a.or_(x86::qword_ptr(verdict, offsetof(rule_verdict, mark_bits)), x86::rax);
+        }
+
+        a.bind(next_rule);
+    }
+
+    a.ret();
+
+    Error err = jit->runtime.add(&func, &code);
+
+    if ( err ) {
+        log(LOG_WARN, "could not compile rule set to native code, falling back to interpreter: {}",
+            DebugUtils::errorAsString(err));
+
+        func = nullptr;
+
+        return false;
+    }
+
+    return true;
+}
+#else
+bool compiled_rule_set::compile() {
+    return false;
+}
+#endif
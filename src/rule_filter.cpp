@@ -0,0 +1,115 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#include <rule_filter.hpp>
+
+#include <common/file_utils.hpp>
+
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+
+static __inline void init_rule_match_key(rule_match_key& key, rte_mbuf* mbuf, const packet_private_info* packet_info) {
+    key.vlan            = packet_info->vlan;
+    key.src_endpoint_id = packet_info->src_endpoint_id;
+
+    uint32_t first_seg_len = rte_pktmbuf_data_len(mbuf);
+
+    // Headers are read in place, so they have to be in the first segment
+    if ( packet_info->ether_type != ether_type_info< RTE_ETHER_TYPE_IPV4 >::ether_type_be ||
+         (uint32_t) packet_info->l3_offset + sizeof(rte_ipv4_hdr) > first_seg_len ) {
+        key.src_addr = 0;
+        key.dst_addr = 0;
+        key.src_port = 0;
+        key.dst_port = 0;
+        key.proto    = 0;
+        key.is_ipv4  = 0;
+
+        return;
+    }
+
+    const auto* ipv4_header = rte_pktmbuf_mtod_offset(mbuf, const rte_ipv4_hdr*, packet_info->l3_offset);
+
+    key.src_addr = rte_be_to_cpu_32(ipv4_header->src_addr);
+    key.dst_addr = rte_be_to_cpu_32(ipv4_header->dst_addr);
+    key.proto    = packet_info->ipv4_type;
+    key.is_ipv4  = 1;
+
+    // Only the first fragment carries the l4 header. Too short ones match as port 0
+    if ( (key.proto == IP_PROTO_TCP || key.proto == IP_PROTO_UDP) && !packet_info->is_fragment &&
+         (uint32_t) packet_info->l4_offset + sizeof(rte_udp_hdr) <= first_seg_len ) {
+        // Source and destination port are at the same offset for TCP and UDP
+        const auto* udp_header = rte_pktmbuf_mtod_offset(mbuf, const rte_udp_hdr*, packet_info->l4_offset);
+
+        key.src_port = rte_be_to_cpu_16(udp_header->src_port);
+        key.dst_port = rte_be_to_cpu_16(udp_header->dst_port);
+    } else {
+        key.src_port = 0;
+        key.dst_port = 0;
+    }
+}
+
+
+rule_filter::rule_filter(std::string                            name,
+                         std::shared_ptr< dpdk_packet_mempool > mempool,
+                         std::shared_ptr< flow_database >       flow_database_ptr) :
+    flow_processor(std::move(name), std::move(mempool)) {}
+
+uint16_t rule_filter::process(mbuf_vec_base& mbuf_vec, flow_proc_context& ctx) {
+    const compiled_rule_set& rules = *rule_set;
+
+    for ( auto packet : mbuf_vec ) {
+        auto* packet_info = get_private_packet_info(packet);
+
+        rule_match_key key;
+        rule_verdict   verdict;
+
+        init_rule_match_key(key, packet, packet_info);
+
+        rules.evaluate(key, verdict);
+
+        if ( verdict.mark_bits && packet_info->flow_info ) {
+            packet_info->flow_info->mark |= verdict.mark_bits;
+        }
+
+        if ( verdict.dst_endpoint_id != PORT_ID_IGNORE ) {
+            packet_info->dst_endpoint_id = verdict.dst_endpoint_id;
+        }
+    }
+
+    return mbuf_vec.size();
+}
+
+void rule_filter::init(const flow_proc_builder& builder) {
+    auto rules_opt          = builder.get_param("rules");
+    auto rules_filename_opt = builder.get_param("rules_filename");
+
+    std::string rules_source;
+
+    if ( rules_opt.has_value() ) {
+        rules_source = rules_opt.value();
+    } else if ( rules_filename_opt.has_value() ) {
+        rules_source = load_file_as_string(rules_filename_opt.value());
+    } else {
+        throw std::runtime_error("neither rules nor rules_filename set");
+    }
+
+    bool allow_jit = true;
+
+    auto jit_opt = builder.get_param("jit");
+
+    if ( jit_opt.has_value() ) {
+        allow_jit = (jit_opt.value() == "true");
+    }
+
+    rule_set = std::make_unique< compiled_rule_set >(parse_rules(rules_source), allow_jit);
+
+    log(LOG_INFO,
+        "rule filter {} loaded {} rules ({})",
+        get_name(),
+        rule_set->size(),
+        rule_set->is_native() ? "native" : "interpreted");
+}
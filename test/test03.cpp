@@ -0,0 +1,111 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#include <common/common.hpp>
+
+#include <rule_compiler.hpp>
+
+
+static const char* test_rules = R"(
+# Mark everything coming from 10.0.0.0/8, then decide
+src_ip 10.0.0.0/8                           -> mark 3
+proto udp dst_port 53                       -> forward 1
+proto tcp dst_port 8000-8999 src_endpoint 0 -> forward 2
+vlan 100                                    -> drop
+dst_ip 255.255.255.255                      -> broadcast
+src_ip 192.168.1.1                          -> pass
+any                                         -> forward 0
+)";
+
+static rule_match_key make_key(uint32_t src_addr,
+                               uint32_t dst_addr,
+                               uint8_t  proto,
+                               uint16_t src_port,
+                               uint16_t dst_port,
+                               uint16_t vlan,
+                               uint16_t src_endpoint_id) {
+    rule_match_key key {};
+
+    key.src_addr        = src_addr;
+    key.dst_addr        = dst_addr;
+    key.proto           = proto;
+    key.src_port        = src_port;
+    key.dst_port        = dst_port;
+    key.vlan            = vlan;
+    key.src_endpoint_id = src_endpoint_id;
+    key.is_ipv4         = 1;
+
+    return key;
+}
+
+int main(int argc, char** argv) {
+    std::vector< std::pair< rule_match_key, rule_verdict > > cases = {
+        {make_key(0x0a000001, 0x08080808, IP_PROTO_UDP, 4000, 53, 0, 0), {1ULL << 3, 1}},
+        {make_key(0x0b000001, 0x08080808, IP_PROTO_UDP, 4000, 53, 0, 0), {0, 1}},
+        {make_key(0x0b000001, 0x08080808, IP_PROTO_TCP, 4000, 8080, 0, 0), {0, 2}},
+        {make_key(0x0b000001, 0x08080808, IP_PROTO_TCP, 4000, 8080, 0, 1), {0, 0}},
+        {make_key(0x0b000001, 0x08080808, IP_PROTO_TCP, 4000, 9000, 100, 0), {0, PORT_ID_DROP}},
+        {make_key(0x0a0000ff, 0xffffffff, IP_PROTO_ICMP, 0, 0, 0, 1), {1ULL << 3, PORT_ID_BROADCAST}},
+        {make_key(0xc0a80101, 0x08080808, IP_PROTO_ICMP, 0, 0, 0, 1), {0, PORT_ID_IGNORE}}};
+
+    rule_match_key non_ipv4_key {};
+
+    non_ipv4_key.vlan = 100;
+
+    cases.push_back({non_ipv4_key, {0, PORT_ID_DROP}});
+
+    int num_failures = 0;
+
+    try {
+        compiled_rule_set interpreted(parse_rules(test_rules), false);
+        compiled_rule_set native(parse_rules(test_rules));
+
+        log(LOG_INFO, "rule set has {} rules, native code: {}", native.size(), native.is_native());
+
+        for ( size_t idx = 0; idx < cases.size(); ++idx ) {
+            const auto& [key, expected] = cases[idx];
+
+            for ( const compiled_rule_set* rules : {&interpreted, &native} ) {
+                rule_verdict verdict;
+
+                rules->evaluate(key, verdict);
+
+                if ( verdict.mark_bits != expected.mark_bits ||
+                     verdict.dst_endpoint_id != expected.dst_endpoint_id ) {
+                    log(LOG_ERROR,
+                        "case {} ({}): got mark {:#x} dst {} but expected mark {:#x} dst {}",
+                        idx,
+                        rules->is_native() ? "native" : "interpreted",
+                        verdict.mark_bits,
+                        verdict.dst_endpoint_id,
+                        expected.mark_bits,
+                        expected.dst_endpoint_id);
+
+                    ++num_failures;
+                }
+            }
+        }
+
+        for ( const char* invalid_rules :
+              {"src_ip 10.0.0/8 -> drop", "dst_port 10-5 -> drop", "vlan 1", "any -> mark 64", "any -> forward 32767"} ) {
+            try {
+                parse_rules(invalid_rules);
+
+                log(LOG_ERROR, "invalid rule '{}' was accepted", invalid_rules);
+
+                ++num_failures;
+            } catch ( const std::exception& e ) { log(LOG_INFO, "rejected as expected: {}", e.what()); }
+        }
+    } catch ( const std::exception& e ) {
+        log(LOG_ERROR, "rule compiler test failed: {}", e.what());
+
+        return 1;
+    }
+
+    log(LOG_INFO, "rule compiler test done with {} failures", num_failures);
+
+    return num_failures ? 1 : 0;
+}
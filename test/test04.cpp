@@ -0,0 +1,114 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#include <common/common.hpp>
+
+#include <flow_base.hpp>
+#include <flow_processor.hpp>
+
+
+// Just enough of a packet for the grouper: the private area directly follows the mbuf header
+struct fake_packet
+{
+    rte_mbuf mbuf;
+
+    packet_private_info info;
+};
+
+struct expected_group
+{
+    size_t flow_idx;
+
+    std::vector< uint16_t > packet_indices;
+};
+
+int main(int argc, char** argv) {
+    std::array< flow_info_ipv4, 3 > flows {};
+
+    // -1 means no flow, e.g. non ipv4
+    const std::vector< int > packet_flows = {0, 0, 1, 0, -1, 2, 1};
+
+    const std::vector< expected_group > expected = {{0, {0, 1, 3}}, {1, {2, 6}}, {2, {5}}};
+
+    std::vector< fake_packet > packets(packet_flows.size());
+
+    static_mbuf_vec< MAX_BURST_SIZE > mbuf_vec;
+
+    for ( size_t idx = 0; idx < packets.size(); ++idx ) {
+        packets[idx].info.flow_info = (packet_flows[idx] < 0) ? nullptr : &flows[packet_flows[idx]];
+
+        mbuf_vec.base()[idx] = &packets[idx].mbuf;
+    }
+
+    mbuf_vec.set_size((uint16_t) packets.size());
+
+    int num_failures = 0;
+
+    flow_group_table groups;
+
+    if ( groups.is_valid_for(mbuf_vec) ) {
+        log(LOG_ERROR, "empty group table is valid");
+
+        ++num_failures;
+    }
+
+    groups.build(mbuf_vec);
+
+    if ( !groups.is_valid_for(mbuf_vec) ) {
+        log(LOG_ERROR, "group table is not valid for the burst it was built for");
+
+        ++num_failures;
+    }
+
+    if ( groups.size() != expected.size() ) {
+        log(LOG_ERROR, "got {} groups but expected {}", groups.size(), expected.size());
+
+        ++num_failures;
+    } else {
+        for ( uint16_t group_idx = 0; group_idx < groups.size(); ++group_idx ) {
+            const auto& g = groups[group_idx];
+
+            std::vector< uint16_t > packet_indices(groups.packet_indices(g), groups.packet_indices(g) + g.count);
+
+            if ( g.flow_info != &flows[expected[group_idx].flow_idx] ||
+                 packet_indices != expected[group_idx].packet_indices ) {
+                log(LOG_ERROR, "group {} has the wrong flow or packets", group_idx);
+
+                ++num_failures;
+            }
+
+            for ( uint16_t packet_idx : packet_indices ) {
+                if ( groups.group_of(packet_idx) != group_idx ) {
+                    log(LOG_ERROR, "packet {} is not in group {}", packet_idx, group_idx);
+
+                    ++num_failures;
+                }
+            }
+        }
+    }
+
+    if ( groups.group_of(4) != flow_group_table::NO_GROUP ) {
+        log(LOG_ERROR, "packet without flow got a group");
+
+        ++num_failures;
+    }
+
+    // Removing a packet invalidates the table
+    mbuf_vec.consume_back(1);
+
+    if ( groups.is_valid_for(mbuf_vec) ) {
+        log(LOG_ERROR, "group table is still valid after the burst shrank");
+
+        ++num_failures;
+    }
+
+    // The packets are not real, nothing must be freed
+    mbuf_vec.consume();
+
+    log(LOG_INFO, "flow group table test done with {} failures", num_failures);
+
+    return num_failures ? 1 : 0;
+}
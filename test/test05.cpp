@@ -0,0 +1,103 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#include <common/common.hpp>
+
+#include <flow_manager.hpp>
+
+
+struct burst_step
+{
+    uint16_t num_received;
+
+    // Burst size after the update
+    uint16_t expected_size;
+};
+
+static int run_case(const char*                      name,
+                    burst_size_limits                limits,
+                    uint16_t                         initial_size,
+                    const std::vector< burst_step >& steps) {
+    adaptive_burst_size burst_size(limits);
+
+    int num_failures = 0;
+
+    if ( burst_size.get() != initial_size ) {
+        log(LOG_ERROR, "{}: starts at {} but expected {}", name, burst_size.get(), initial_size);
+
+        ++num_failures;
+    }
+
+    for ( size_t idx = 0; idx < steps.size(); ++idx ) {
+        burst_size.update(steps[idx].num_received);
+
+        if ( burst_size.get() != steps[idx].expected_size ) {
+            log(LOG_ERROR,
+                "{}: step {} ({} received) gave {} but expected {}",
+                name,
+                idx,
+                steps[idx].num_received,
+                burst_size.get(),
+                steps[idx].expected_size);
+
+            ++num_failures;
+        }
+    }
+
+    return num_failures;
+}
+
+int main(int argc, char** argv) {
+    int num_failures = 0;
+
+    // Full bursts double up to the maximum
+    num_failures += run_case("grow", {8, 64}, 8, {{8, 16}, {16, 32}, {32, 64}, {64, 64}, {64, 64}});
+
+    // Shrinks only after SHRINK_THRESHOLD underfilled bursts in a row, never below the minimum
+    std::vector< burst_step > shrink_steps = {{8, 16}, {16, 32}};
+
+    for ( uint16_t idx = 1; idx < adaptive_burst_size::SHRINK_THRESHOLD; ++idx ) {
+        shrink_steps.push_back({1, 32});
+    }
+
+    shrink_steps.push_back({1, 16});
+
+    for ( uint16_t idx = 0; idx < adaptive_burst_size::SHRINK_THRESHOLD * 2; ++idx ) {
+        shrink_steps.push_back({0, (idx < adaptive_burst_size::SHRINK_THRESHOLD - 1) ? uint16_t(16) : uint16_t(8)});
+    }
+
+    num_failures += run_case("shrink", {8, 64}, 8, shrink_steps);
+
+    // A burst that is at least half full resets the underfilled count
+    std::vector< burst_step > reset_steps = {{8, 16}};
+
+    for ( uint16_t idx = 1; idx < adaptive_burst_size::SHRINK_THRESHOLD; ++idx ) {
+        reset_steps.push_back({1, 16});
+    }
+
+    reset_steps.push_back({8, 16});
+
+    for ( uint16_t idx = 1; idx < adaptive_burst_size::SHRINK_THRESHOLD; ++idx ) {
+        reset_steps.push_back({1, 16});
+    }
+
+    reset_steps.push_back({1, 8});
+
+    num_failures += run_case("reset", {8, 64}, 8, reset_steps);
+
+    // Equal limits mean a fixed size
+    std::vector< burst_step > fixed_steps = {{32, 32}};
+
+    for ( uint16_t idx = 0; idx < adaptive_burst_size::SHRINK_THRESHOLD * 2; ++idx ) {
+        fixed_steps.push_back({0, 32});
+    }
+
+    num_failures += run_case("fixed", {32, 32}, 32, fixed_steps);
+
+    log(LOG_INFO, "adaptive burst size test done with {} failures", num_failures);
+
+    return num_failures ? 1 : 0;
+}
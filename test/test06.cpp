@@ -0,0 +1,159 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ * Copyright (c) 2021,  Stefan Seitz
+ *
+ */
+
+#include <common/common.hpp>
+#include <dpdk/dpdk_common.hpp>
+
+#include <flow_base.hpp>
+#include <lua_packet_filter.hpp>
+
+#include <cstdio>
+#include <fstream>
+
+
+// Just enough of a packet for a filter that only has on_new_flow: the private area directly follows the mbuf header
+struct fake_packet
+{
+    rte_mbuf mbuf;
+
+    packet_private_info info;
+};
+
+// The flow local storage directly follows the flow info
+struct fake_flow
+{
+    flow_info_ipv4 info;
+
+    uint8_t storage[FLOW_LOCAL_STORAGE_SIZE];
+};
+
+static const char* script_filename = "test06_filter.lua";
+
+static void write_script(uint16_t dst_endpoint_id) {
+    std::ofstream script(script_filename, std::ios::trunc);
+
+    script << fmt::format("function on_new_flow(flow)\n    return {}\nend\n", dst_endpoint_id);
+}
+
+// Runs one burst with every packet on its own flow and returns the number of packets that didn't get expected_dst
+static int run_burst(lua_packet_filter&          filter,
+                     std::vector< fake_packet >& packets,
+                     bool                        new_flows,
+                     uint16_t                    expected_dst) {
+    static_mbuf_vec< MAX_BURST_SIZE > mbuf_vec;
+
+    for ( size_t idx = 0; idx < packets.size(); ++idx ) {
+        // What the validator sets. A filter that doesn't decide a flow leaves it like that
+        packets[idx].info.dst_endpoint_id = PORT_ID_BROADCAST;
+        packets[idx].info.new_flow        = new_flows;
+
+        mbuf_vec.base()[idx] = &packets[idx].mbuf;
+    }
+
+    mbuf_vec.set_size((uint16_t) packets.size());
+
+    flow_proc_context ctx(flow_dir::RX, 0);
+
+    filter.process(mbuf_vec, ctx);
+
+    int num_wrong = 0;
+
+    for ( const auto& packet : packets ) {
+        if ( packet.info.dst_endpoint_id != expected_dst ) {
+            ++num_wrong;
+        }
+    }
+
+    // The packets are not real, nothing must be freed
+    mbuf_vec.consume();
+
+    return num_wrong;
+}
+
+int main(int argc, char** argv) {
+    try {
+        dpdk_eal_init({"--no-shconf", "--in-memory", "-l", "1,2,3,4"});
+    } catch ( const std::exception& e ) {
+        log(LOG_ERROR, "could not init dpdk eal: {}", e.what());
+
+        return 1;
+    }
+
+    int num_failures = 0;
+
+    try {
+        auto flow_database_ptr =
+            std::make_shared< flow_database >(1024, std::vector< lcore_info > {lcore_info::get_main_lcore()});
+
+        std::vector< fake_flow >   flows(4);
+        std::vector< fake_packet > packets(flows.size());
+
+        for ( size_t idx = 0; idx < flows.size(); ++idx ) {
+            flows[idx].info.flow_hash          = idx + 1;
+            flows[idx].info.overwrite_dst_port = PORT_ID_IGNORE;
+
+            packets[idx].info.flow_info = &flows[idx].info;
+        }
+
+        write_script(1);
+
+        flow_proc_builder builder("filter", "lua_packet_filter");
+
+        builder.set_param("script_filename", script_filename);
+        builder.set_param("watch_script", "true");
+
+        lua_packet_filter filter("filter", nullptr, flow_database_ptr);
+
+        filter.init(builder);
+        filter.lcore_init(rte_lcore_id());
+
+        if ( run_burst(filter, packets, true, 1) ) {
+            log(LOG_ERROR, "new flows did not get the verdict of on_new_flow");
+
+            ++num_failures;
+        }
+
+        if ( run_burst(filter, packets, false, 1) ) {
+            log(LOG_ERROR, "known flows did not get their cached verdict");
+
+            ++num_failures;
+        }
+
+        // The flows stay alive across the reload. They have to be decided again by the new script instead of falling
+        // back to the default destination
+        write_script(2);
+
+        int num_wrong = 0;
+
+        for ( int attempt = 0; attempt < 100; ++attempt ) {
+            rte_delay_us_sleep(10000);
+
+            filter.control_poll();
+
+            num_wrong = run_burst(filter, packets, false, 2);
+
+            if ( !num_wrong ) {
+                break;
+            }
+        }
+
+        if ( num_wrong ) {
+            log(LOG_ERROR, "{} existing flows were not decided again after the reload", num_wrong);
+
+            ++num_failures;
+        }
+    } catch ( const std::exception& e ) {
+        log(LOG_ERROR, "lua filter reload test failed: {}", e.what());
+
+        return 1;
+    }
+
+    std::remove(script_filename);
+
+    log(LOG_INFO, "lua filter reload test done with {} failures", num_failures);
+
+    return num_failures ? 1 : 0;
+}
@@ -12,13 +12,17 @@ function init(endpoints)
 
         local packet_validator = flow.proc("ingress_packet_validator", "validator")
         local flow_classifier = flow.proc("flow_classifier", "classifier")
+        local flow_grouper = flow.proc("flow_grouper", "grouper")
         local lua_filter = flow.proc("lua_packet_filter", "filter01")
 
         lua_filter:set_param("eval_flow_once", "true")
+        lua_filter:set_param("group_by_flow", "true")
+        lua_filter:set_param("watch_script", "true")
         lua_filter:set_param("script_filename", "test/filter01.lua")
 
         packet_validator:next(flow_classifier)
-        flow_classifier:next(lua_filter)
+        flow_classifier:next(flow_grouper)
+        flow_grouper:next(lua_filter)
 
         endpoint:add_rx_proc(packet_validator)
     end